@@ -1,7 +1,9 @@
 #ifndef __ASYNC__
 #define __ASYNC__
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include <fsdyn/fsalloc.h>
 
@@ -44,6 +46,11 @@ typedef struct async_timer async_timer_t;
  */
 typedef struct async_event async_event_t;
 
+/*
+ * An opaque loop-phase hook (see async_add_prepare_hook()).
+ */
+typedef struct async_hook async_hook_t;
+
 /*
  * Create an async object.
  *
@@ -64,6 +71,17 @@ void destroy_async(async_t *async);
  */
 uint64_t async_now(async_t *async);
 
+/*
+ * Return the point in time (in async_now() time frame) when the async
+ * object last looked at the clock. The main loop looks at the clock
+ * once per iteration before dispatching callbacks, so the value may lag
+ * behind async_now() by the time the callbacks of the iteration have
+ * taken. However, no timer fires before async_recent() has reached its
+ * expiry. async_recent() is cheap; call async_now() when you need the
+ * exact time.
+ */
+uint64_t async_recent(async_t *async);
+
 #define ASYNC_NS   ((int64_t) 1)
 #define ASYNC_US   (1000 * ASYNC_NS)
 #define ASYNC_MS   (1000 * ASYNC_US)
@@ -86,6 +104,140 @@ async_timer_t *async_timer_start(async_t *async, uint64_t expires,
  */
 void async_timer_cancel(async_t *async, async_timer_t *timer);
 
+/*
+ * Like async_timer_start() but the timer may fire up to slack
+ * nanoseconds after expires. The expiry is moved to the latest point
+ * of the window that is a multiple of the largest power of two not
+ * exceeding slack. Timers whose windows overlap thus tend to expire at
+ * the same instant and are fired in a single wakeup of the loop.
+ */
+async_timer_t *async_timer_start_slack(async_t *async, uint64_t expires,
+                                       uint64_t slack, action_1 action);
+
+/*
+ * A persistent timer is embedded in the user's object and initialized
+ * once with async_timer_init(). It can then be armed, rearmed and
+ * stopped any number of times without memory allocation. Rearming an
+ * armed timer moves it in place. The fields are private to async.
+ *
+ * A persistent timer must be stopped before its memory is released.
+ * It must not be passed to async_timer_cancel().
+ */
+struct async_timer {
+    uint64_t expires;
+    uint64_t seqno;
+    bool immediate;
+    unsigned prio; /* the async_prio_t of an immediate timer */
+    bool embedded; /* rather than allocated by async */
+    bool armed;
+    uint64_t period; /* 0 unless periodic */
+    int level;  /* in the timing wheel or -1 */
+    void *loc;  /* in timers */
+    async_timer_t *prev, *next; /* in immediate or a timing wheel slot */
+    action_1 action;
+    void **stack_trace; /* Where the timer was scheduled or NULL */
+};
+
+void async_timer_init(async_timer_t *timer, action_1 action);
+
+/*
+ * Arm the timer to expire at the given time. The timer is disarmed
+ * before its action is performed.
+ */
+void async_timer_rearm(async_t *async, async_timer_t *timer,
+                       uint64_t expires);
+
+/*
+ * Like async_timer_rearm() but with slack (see
+ * async_timer_start_slack()).
+ */
+void async_timer_rearm_slack(async_t *async, async_timer_t *timer,
+                             uint64_t expires, uint64_t slack);
+
+/*
+ * Arm the timer to expire at the given time and every period
+ * nanoseconds thereafter until it is stopped. The expiries do not
+ * drift; if the loop falls behind by more than a period, the missed
+ * expiries are skipped. The timer is rearmed before its action is
+ * performed so the action may stop or rearm it.
+ */
+void async_timer_rearm_periodic(async_t *async, async_timer_t *timer,
+                                uint64_t expires, uint64_t period);
+
+/*
+ * Disarm the timer. The function has no effect on a disarmed timer.
+ */
+void async_timer_stop(async_t *async, async_timer_t *timer);
+
+bool async_timer_armed(async_timer_t *timer);
+
+/*
+ * Timers are kept in a hierarchical timing wheel, which makes starting
+ * and canceling a timer a constant-time operation. Timers that are too
+ * far in the future for the wheel (hours) are kept in a priority queue
+ * ordered by the exact expiry. Timers fire at their exact expiry in
+ * either case.
+ *
+ * After async_disable_timing_wheel() is called, the async object keeps
+ * all new timers in the priority queue. The function is mainly useful
+ * for performance comparisons.
+ */
+void async_disable_timing_wheel(async_t *async);
+
+/*
+ * By default, async_loop() and async_loop_protected() round the wait
+ * for the next timer up to whole milliseconds on Linux. After
+ * async_enable_high_resolution() is called, the async object waits
+ * with nanosecond precision using epoll_pwait2(2) where available
+ * (Linux 5.11 and later). The precision of kqueue and io_uring waits is
+ * not affected.
+ */
+void async_enable_high_resolution(async_t *async);
+
+/*
+ * Return true if the async object monitors file descriptors through an
+ * io_uring(7) ring rather than epoll(7) or kqueue(2). That is the case
+ * when async is built with io-uring=1 and the kernel supports the
+ * necessary features.
+ */
+bool async_uses_io_uring(async_t *async);
+
+/*
+ * The scheduling policy of async_loop() and async_loop_protected().
+ *
+ * Each wait for I/O returns at most io_burst ready events. A larger
+ * burst means fewer system calls when many file descriptors are busy.
+ *
+ * At most callback_budget timer and immediate callbacks (including the
+ * I/O callbacks, which are scheduled as immediate tasks) are performed
+ * before I/O is polled again. A smaller budget makes the loop notice
+ * new I/O sooner while it is busy, trading throughput for latency.
+ *
+ * In the adaptive mode, the burst starts at io_burst and doubles
+ * whenever a wait fills the batch, up to max_io_burst. It shrinks back
+ * gradually when the batches stay small.
+ */
+enum {
+    ASYNC_DEFAULT_IO_BURST = 20,
+    ASYNC_DEFAULT_CALLBACK_BUDGET = 20,
+};
+
+typedef struct {
+    unsigned io_burst;
+    unsigned callback_budget;
+    bool adaptive;
+    unsigned max_io_burst; /* only used in the adaptive mode */
+} async_policy_t;
+
+void async_get_policy(async_t *async, async_policy_t *policy);
+
+/*
+ * Return a negative number and set errno to EINVAL if a count is 0 or
+ * max_io_burst is smaller than io_burst in the adaptive mode. The
+ * policy takes effect from the next wait for I/O on.
+ */
+int async_set_policy(async_t *async, const async_policy_t *policy);
+
 /*
  * Create an event. The event must be triggered separately after
  * creation.
@@ -116,6 +268,72 @@ void destroy_async_event(async_event_t *event);
  */
 async_timer_t *async_execute(async_t *async, action_1 action);
 
+/*
+ * Immediate tasks are performed in the order of their priority and in
+ * the FIFO order within a priority. A waiting task is passed over by at
+ * most about ASYNC_PRIO_STARVATION_LIMIT tasks of higher priorities
+ * before it gets its turn. I/O callbacks run at ASYNC_PRIO_NORMAL, as
+ * do the tasks of async_execute() and its relatives. Due timers are
+ * interleaved with the tasks by their expiry regardless of priority.
+ */
+typedef enum {
+    ASYNC_PRIO_HIGH,
+    ASYNC_PRIO_NORMAL,
+    ASYNC_PRIO_LOW,
+    ASYNC_PRIO_LEVELS
+} async_prio_t;
+
+enum {
+    ASYNC_PRIO_STARVATION_LIMIT = 16,
+};
+
+/*
+ * Like async_execute() but with the given priority.
+ */
+async_timer_t *async_execute_prio(async_t *async, async_prio_t prio,
+                                  action_1 action);
+
+/*
+ * Like async_execute() but the function can be called safely from any
+ * thread without locking. The tasks are performed in the order they
+ * were submitted by each thread. The main loop is woken up once per
+ * batch of tasks: only the first of the tasks submitted while the loop
+ * is busy writes to the wakeup file descriptor.
+ *
+ * Tasks that have not been performed by the time the async object is
+ * destroyed are discarded.
+ */
+void async_execute_remote(async_t *async, action_1 action);
+
+/*
+ * A once coalesces repeated executions of an action. However many times
+ * async_execute_once() is called before the action is performed, the
+ * action is performed only once. A call made after (or during) the
+ * performance schedules the action anew. No memory is allocated per
+ * call.
+ *
+ * The once is typically embedded in the object that is referred to by
+ * the action and initialized with async_once_init(). The fields are
+ * private to async.
+ */
+typedef struct {
+    async_timer_t *timer; /* or NULL if no execution is pending */
+    action_1 action;
+} async_once_t;
+
+void async_once_init(async_once_t *once);
+
+/*
+ * Schedule the execution of action unless it is pending already. If
+ * it is, action replaces the pending action.
+ */
+void async_execute_once(async_t *async, async_once_t *once, action_1 action);
+
+/*
+ * Cancel the pending execution, if any.
+ */
+void async_once_cancel(async_t *async, async_once_t *once);
+
 /*
  * Deallocate object using fsfree() from the main loop. The caller
  * should incapacitate the object in the meantime so no new references
@@ -125,9 +343,41 @@ async_timer_t *async_execute(async_t *async, action_1 action);
  * immediate fsfree() call might be dangerous because of references in
  * scheduled tasks. So instead, you should call async_wound() and mark
  * the object as no longer operational.
+ *
+ * The wounded objects are freed in bulk at the start of a loop
+ * iteration once the immediate tasks (of any priority) that were
+ * pending at the time of the call have been performed. Timers that
+ * refer to the object must be canceled.
  */
 void async_wound(async_t *async, void *object);
 
+/*
+ * A prepare hook is called once per iteration of async_loop() and
+ * async_loop_protected() when the tasks and due timers have run out,
+ * right before the loop waits for I/O. async_poll() and async_poll_n()
+ * call the prepare hooks when they find no due timers. If a prepare
+ * hook schedules tasks or timers, they are taken into account before
+ * the loop blocks.
+ *
+ * A check hook is called by async_loop(), async_loop_protected(),
+ * async_poll() and async_poll_n() right after each wait for I/O that
+ * yields events, before any of the I/O callbacks is performed.
+ *
+ * A typical prepare hook flushes output accumulated during the
+ * iteration so that many small messages make a single write.
+ *
+ * The hooks are called in the order they were added. A hook added
+ * during the calls is first called at the next opportunity.
+ */
+async_hook_t *async_add_prepare_hook(async_t *async, action_1 action);
+async_hook_t *async_add_check_hook(async_t *async, action_1 action);
+
+/*
+ * Remove and free a hook. The function may be called from a hook
+ * (including the hook itself).
+ */
+void async_remove_hook(async_t *async, async_hook_t *hook);
+
 /*
  * Returns a single file descriptor that can be used to integrate this
  * library with some other event framework. Whenever the returned file
@@ -158,6 +408,24 @@ int async_fd(async_t *async);
  */
 int async_poll(async_t *async, uint64_t *pnext_timeout);
 
+/*
+ * Like async_poll() but performs up to max callbacks (due timers,
+ * tasks and I/O callbacks) per call instead of one. Ready I/O events
+ * are harvested in batches as long as there is room for them.
+ *
+ * The function stops early once budget nanoseconds have elapsed since
+ * it was called; at least one callback is performed, though, if one
+ * is due. Pass (uint64_t) -1 for no time limit.
+ *
+ * Returns the number of callbacks performed or a negative number in
+ * case of an error (consult errno). pnext_timeout is passed back as
+ * with async_poll().
+ *
+ * The function never blocks.
+ */
+int async_poll_n(async_t *async, unsigned max, uint64_t budget,
+                 uint64_t *pnext_timeout);
+
 /*
  * If the async object is linked with an external main loop,
  * async_poll() must be called as soon as async_fd() becomes readable.
@@ -184,7 +452,9 @@ int async_poll_2(async_t *async);
  * These functions must not be called while async_loop() is in execution:
  *  - async_loop()
  *  - async_loop_protected()
+ *  - async_loop_protected_2()
  *  - async_poll()
+ *  - async_poll_n()
  *  - async_poll_2()
  *  - destroy_async()
  */
@@ -208,13 +478,39 @@ int async_loop(async_t *async);
  * execution:
  *  - async_loop()
  *  - async_loop_protected()
+ *  - async_loop_protected_2()
  *  - async_poll()
+ *  - async_poll_n()
  *  - async_poll_2()
  *  - destroy_async()
  */
 int async_loop_protected(async_t *async, void (*lock)(void *),
                          void (*unlock)(void *), void *lock_data);
 
+/*
+ * Like async_loop_protected(), async_loop_protected_2() releases the
+ * lock before every wait for I/O that may block. When there is more
+ * work to do and the wait will not block, the lock is kept unless it
+ * has been held for max_hold nanoseconds. Thus, the callbacks of a busy
+ * loop are performed in batches of about max_hold nanoseconds per lock
+ * hold.
+ *
+ * A max_hold of 0 releases the lock at every iteration, which is what
+ * async_loop_protected() does. A larger max_hold cuts down on lock
+ * traffic at the expense of the latency of the other threads that need
+ * the lock; ASYNC_SUGGESTED_MAX_LOCK_HOLD is a reasonable starting
+ * point.
+ *
+ * The lock statistics of async_get_stats() (qv) help tune max_hold.
+ */
+enum {
+    ASYNC_SUGGESTED_MAX_LOCK_HOLD = 100 * ASYNC_US,
+};
+
+int async_loop_protected_2(async_t *async, void (*lock)(void *),
+                           void (*unlock)(void *), void *lock_data,
+                           uint64_t max_hold);
+
 /*
  * This function causes async_loop() or async_loop_protected() to return
  * after processing the current event. It can be called safely from a
@@ -233,6 +529,154 @@ void async_quit_loop(async_t *async);
  */
 int async_flush(async_t *async, uint64_t expires);
 
+/*
+ * Histograms of the loop statistics have ASYNC_STATS_BUCKETS
+ * logarithmic buckets. Bucket 0 counts zero values and bucket n > 0
+ * counts values v with 2^(n-1) <= v < 2^n. The last bucket counts
+ * greater values as well.
+ */
+enum {
+    ASYNC_STATS_BUCKETS = 40,
+};
+
+typedef struct {
+    uint64_t bucket[ASYNC_STATS_BUCKETS];
+} async_histogram_t;
+
+/*
+ * The counters and histograms are cumulative from the creation of the
+ * async object. The fields are all uint64_t.
+ */
+typedef struct {
+    uint64_t iterations;        /* of async_loop() and the like */
+    uint64_t callbacks;         /* timers and tasks dispatched */
+    uint64_t starved_iterations; /* I/O polled before the tasks ran out */
+    uint64_t io_waits;
+    uint64_t full_io_batches;   /* the burst limit of I/O events hit */
+    uint64_t busy_ns;           /* spent outside blocking waits */
+    uint64_t blocked_ns;        /* spent in blocking waits */
+    uint64_t lock_releases;     /* before a wait for I/O */
+    uint64_t unlocks_skipped;   /* lock kept over a nonblocking wait */
+    uint64_t contended_locks;   /* lock regained after 1 us or more */
+    async_histogram_t timer_lateness;      /* dispatch - expiry, ns */
+    async_histogram_t iteration_callbacks; /* callbacks per iteration */
+    async_histogram_t io_batch;            /* I/O events per wait */
+    async_histogram_t immediate_depth;     /* tasks per iteration */
+    async_histogram_t lock_hold;           /* per hold of the lock, ns */
+    async_histogram_t lock_wait;           /* to regain the lock, ns */
+} async_stats_t;
+
+/*
+ * Take a snapshot of the loop statistics. The function can be called
+ * from any thread without locking. Every field is read atomically but
+ * the snapshot as a whole is not; a field may be one iteration ahead of
+ * another.
+ *
+ * The iteration statistics (iterations, starved_iterations, io_waits,
+ * full_io_batches, busy_ns, blocked_ns and the histograms other than
+ * timer_lateness) are collected by async_loop() and
+ * async_loop_protected() only. The lock statistics (lock_releases,
+ * unlocks_skipped, contended_locks, lock_hold and lock_wait) are
+ * collected by async_loop_protected() and async_loop_protected_2().
+ */
+void async_get_stats(async_t *async, async_stats_t *stats);
+
+/*
+ * Profile the callbacks of the main loop. Every period-th callback is
+ * timed, and the count, total and maximum duration of the timed
+ * callbacks are aggregated per act function. The callbacks of events
+ * (including I/O registrations) are attributed to the action of the
+ * event. A zero period (the default) turns profiling off. Calling the
+ * function discards the profile collected so far.
+ *
+ * Profiling costs two clock readings per timed callback. When profiling
+ * is off, the overhead is a single test per callback.
+ */
+void async_set_profiling(async_t *async, unsigned period);
+
+/*
+ * Write the profile to out, one line per act function in the order of
+ * decreasing total duration. Symbols are resolved with
+ * backtrace_symbols(3) where available. The names of static functions
+ * are not available that way but the addresses can be fed to
+ * addr2line(1) like util/bt2sym.sh does with timer backtraces.
+ */
+void async_dump_profile(async_t *async, FILE *out);
+
+typedef struct {
+    void *act;         /* of the stalled callback */
+    uint64_t duration; /* nanoseconds so far */
+    void **backtrace;  /* of the loop thread or NULL */
+    int backtrace_depth;
+} async_stall_t;
+
+typedef void (*async_stall_act)(void *obj, const async_stall_t *stall);
+
+typedef struct {
+    void *obj;
+    async_stall_act act;
+} async_stall_action;
+
+/*
+ * Start a watchdog thread that reports main loop callbacks running
+ * longer than threshold nanoseconds. Each stalled callback is reported
+ * once to the sink. The sink is called from the watchdog thread while
+ * the callback is still running, so it must not touch the async
+ * object. The duration is measured with a precision of about a quarter
+ * of the threshold (but no better than a millisecond).
+ *
+ * Where HAVE_EXECINFO is defined, the loop thread is interrupted with
+ * SIGURG to capture its backtrace. The watchdog installs a SIGURG
+ * handler while it runs and restores the previous disposition when it
+ * is stopped; it fails with EBUSY if the application has a SIGURG
+ * handler of its own. The signal may arrive after the callback has
+ * returned; async_loop() and the like resume waiting if it interrupts
+ * them, but other system calls may fail with EINTR. A backtrace is
+ * reported only if the signal caught the stalled callback. The
+ * backtrace is only valid during the sink callback. See
+ * async_dump_profile() for resolving the addresses.
+ *
+ * Callbacks of events (including I/O registrations) are attributed to
+ * the action of the event.
+ *
+ * A negative return value indicates an error (consult errno).
+ */
+int async_start_watchdog(async_t *async, uint64_t threshold,
+                         async_stall_action sink);
+
+/*
+ * Stop the watchdog thread started with async_start_watchdog(). The
+ * function must not be called from the sink.
+ */
+void async_stop_watchdog(async_t *async);
+
+/*
+ * Run work(arg) in a worker thread and perform completion from the
+ * main loop afterwards. The worker threads form a fixed-size pool that
+ * is started on the first call. The work function must not call the
+ * async library.
+ *
+ * When the async object is destroyed, the work in progress is waited
+ * for but the pending work and completions are discarded.
+ *
+ * A negative return value indicates an error (consult errno).
+ */
+int async_offload(async_t *async, void (*work)(void *arg), void *arg,
+                  action_1 completion);
+
+/*
+ * Set the number of worker threads for async_offload(). The default is
+ * ASYNC_OFFLOAD_THREADS. The function must be called before the first
+ * async_offload() call (EBUSY).
+ *
+ * A negative return value indicates an error (consult errno).
+ */
+int async_set_offload_threads(async_t *async, unsigned count);
+
+enum {
+    ASYNC_OFFLOAD_THREADS = 4,
+};
+
 /*
  * Start monitoring the given socket-like file descriptor for change of
  * status. Whenever the file descriptor becomes readable or writable,
@@ -248,6 +692,38 @@ int async_flush(async_t *async, uint64_t expires);
  */
 int async_register(async_t *async, int fd, action_1 action);
 
+/*
+ * Readiness bits for async_register_2().
+ */
+enum {
+    ASYNC_READABLE = 0x1,
+    ASYNC_WRITABLE = 0x2,
+    ASYNC_HANGUP = 0x4,
+    ASYNC_ERROR = 0x8,
+};
+
+typedef void (*async_io_act)(void *obj, unsigned readiness);
+
+typedef struct {
+    void *obj;
+    async_io_act act;
+} async_io_action;
+
+/*
+ * Like async_register() but only the directions given in interest
+ * (ASYNC_READABLE and/or ASYNC_WRITABLE) are monitored, and the
+ * callback is given the readiness bits that have been reported since
+ * the previous callback. ASYNC_HANGUP and ASYNC_ERROR are reported
+ * regardless of interest.
+ *
+ * A callback with zero readiness may take place if the readiness was
+ * reported before the callback was scheduled by other means.
+ *
+ * A negative return value indicates an error (consult errno).
+ */
+int async_register_2(async_t *async, int fd, unsigned interest,
+                     async_io_action action);
+
 /*
  * Start monitoring the given socket-like file descriptor for change of
  * status. Whenever the file descriptor is readable, the task is run
@@ -6,20 +6,101 @@
 #else
 #define PIPE_WAKEUP 0
 #endif
+#ifndef ASYNC_IO_URING
+#define ASYNC_IO_URING 0
+#endif
 #endif
 
-#include <fsdyn/avltree.h>
-#include <fsdyn/list.h>
 #include <fsdyn/priority_queue.h>
 
 #include "async.h"
 
+/*
+ * Pending timers are kept in a hierarchical timing wheel. Each level
+ * has ASYNC_WHEEL_SLOTS slots; a slot at level n spans
+ * ASYNC_WHEEL_SLOTS^n ticks. Timers that are due (or about to be due)
+ * and timers that are too far in the future for the wheel are kept in
+ * a priority queue ordered by their exact expiry.
+ */
+enum {
+    ASYNC_WHEEL_TICK_SHIFT = 20, /* a tick is about a millisecond */
+    ASYNC_WHEEL_LEVEL_BITS = 6,
+    ASYNC_WHEEL_SLOTS = 1 << ASYNC_WHEEL_LEVEL_BITS,
+    ASYNC_WHEEL_LEVELS = 4,
+};
+
+enum {
+    ASYNC_MAX_SPARE_TIMERS = 1024, /* bound for the timer free list */
+};
+
+typedef struct {
+    bool registered;
+    async_event_t *event; /* possibly ASYNC_SENTINEL_EVENT */
+    unsigned interest;    /* ASYNC_READABLE and/or ASYNC_WRITABLE */
+    bool level_triggered;
+    uint32_t generation;  /* tells apart successive registrations */
+} async_registration_t;
+
+#if ASYNC_IO_URING
+typedef struct async_uring async_uring_t;
+#endif
+
+typedef struct async_remote {
+    struct async_remote *next;
+    action_1 action;
+} async_remote_t;
+
+typedef struct {
+    void *object;
+    uint64_t seqno; /* no task scheduled after the wound has a smaller one */
+} async_wounded_t;
+
+typedef struct async_watchdog async_watchdog_t;
+typedef struct async_offload async_offload_t;
+
+typedef struct {
+    void *act; /* NULL for an unused slot */
+    uint64_t count, total_ns, max_ns;
+} async_profile_entry_t;
+
+/* a list of async_hook_t linked through prev and next */
+typedef struct {
+    async_hook_t *first, *last;
+} async_hook_list_t;
+
+typedef struct {
+    uint64_t occupied; /* a bit for each nonempty slot */
+    async_timer_t *slots[ASYNC_WHEEL_SLOTS];
+} async_wheel_level_t;
+
 struct async {
     uint64_t uid;
     int poll_fd;
-    list_t *immediate; /* of async_timer_t */
+    /* a FIFO of async_timer_t for each priority linked through prev
+     * and next */
+    async_timer_t *immediate[ASYNC_PRIO_LEVELS];
+    async_timer_t *immediate_tail[ASYNC_PRIO_LEVELS];
+    /* higher-priority tasks performed since the FIFO was last served */
+    unsigned passed_over[ASYNC_PRIO_LEVELS];
+    uint64_t immediate_count;
     priorq_t *timers;
-    avl_tree_t *registrations;
+    uint64_t timed_floor; /* no timer in timers expires before this */
+    bool wheel_enabled;
+    bool high_resolution;
+    uint64_t wheel_tick; /* the wheel has been turned up to this tick */
+    async_wheel_level_t wheel[ASYNC_WHEEL_LEVELS];
+    async_timer_t *spare_timers; /* a free list linked through next */
+    unsigned spare_timer_count;
+    async_registration_t *registrations; /* indexed by fd */
+    size_t registration_capacity;
+    async_policy_t policy;
+    unsigned io_burst; /* the current burst, adapted from policy */
+    unsigned small_batches; /* consecutive ones in the adaptive mode */
+    void *io_events; /* a buffer for the epoll or kqueue events */
+    unsigned io_event_capacity;
+#if ASYNC_IO_URING
+    async_uring_t *uring; /* NULL if epoll is used */
+#endif
     volatile bool quit;
 #ifdef __linux__
     int wakeup_fd;
@@ -29,20 +110,36 @@ struct async {
 #else
     bool wakeup_needed;
 #endif
-    list_t *wounded_objects;
+    /* an array of wounded objects in the order of their seqnos */
+    async_wounded_t *wounded;
+    size_t wounded_count, wounded_capacity;
+    async_hook_list_t prepare_hooks, check_hooks;
+    async_hook_t *hook_cursor; /* the next hook to call or NULL */
     uint64_t recent;
+    /* written by the loop only, read by async_get_stats() */
+    async_stats_t stats;
+    uint64_t iteration_started; /* or 0 */
+    uint64_t wait_started; /* or 0 if the loop did not block */
+    unsigned profile_period; /* 0 if profiling is off */
+    unsigned profile_countdown; /* callbacks till the next timed one */
+    async_profile_entry_t *profile; /* an open-addressing hash table */
+    size_t profile_capacity, profile_size;
+    async_watchdog_t *watchdog; /* or NULL */
+    async_offload_t *offload; /* NULL until the first async_offload() */
+    unsigned offload_threads;
+    /* a lock-free LIFO of tasks from async_execute_remote() */
+    async_remote_t *remote;
+    int remote_readfd, remote_writefd; /* the same eventfd on Linux */
 #ifdef __MACH__
     clock_serv_t mach_clock;
 #endif
 };
 
-struct async_timer {
-    uint64_t expires;
+struct async_hook {
+    async_hook_list_t *list;
+    async_hook_t *prev, *next;
     uint64_t seqno;
-    bool immediate;
-    void *loc;
     action_1 action;
-    void **stack_trace; /* Where the timer was scheduled or NULL */
 };
 
 typedef enum {
@@ -57,7 +154,12 @@ struct async_event {
     uint64_t uid;
     async_event_state_t state;
     action_1 action;
+    async_io_action io_action; /* overrides action if set */
+    unsigned readiness; /* reported since the previous callback */
     void **stack_trace; /* Where the timer was scheduled or NULL */
+    /* queued in the immediate FIFO while the event is not idle, so
+     * triggering the event allocates nothing */
+    async_timer_t link;
 };
 
 int async_nonblock(int fd);
@@ -81,3 +183,57 @@ void async_wake_up(async_t *async);
 void async_schedule_wakeup(async_t *async, uint64_t expires);
 void async_arm_wakeup(async_t *async);
 bool async_set_up_wakeup(async_t *async);
+
+/*
+ * The slow-callback watchdog thread. See async_watchdog.c.
+ */
+async_watchdog_t *async_watchdog_create(uint64_t uid, uint64_t threshold,
+                                        async_stall_action sink);
+void async_watchdog_destroy(async_watchdog_t *watchdog);
+
+/* Called by the loop thread around every callback. */
+void async_watchdog_enter(async_watchdog_t *watchdog, void *act);
+void async_watchdog_leave(async_watchdog_t *watchdog);
+
+/* Stop the worker threads of async_offload(). See async_offload.c. */
+void async_offload_destroy(async_offload_t *offload);
+
+#if ASYNC_IO_URING
+/*
+ * The io_uring(7) ring used in place of epoll when async is built
+ * with ASYNC_IO_URING set. See async_uring.c.
+ */
+enum {
+    ASYNC_URING_ENTRIES = 256,
+};
+
+/* The user data of completions that carry no information. */
+#define ASYNC_URING_IGNORE ((uint64_t) -1)
+
+typedef struct {
+    uint64_t user_data;
+    int32_t res;
+    bool more; /* the request remains active */
+} async_uring_completion_t;
+
+/* Return NULL and set errno if io_uring is unavailable. */
+async_uring_t *async_uring_create(unsigned entries);
+void async_uring_destroy(async_uring_t *uring);
+int async_uring_fd(async_uring_t *uring);
+
+/* Queue a request. Return a negative number and set errno if the
+ * submission queue is full and cannot be flushed. */
+int async_uring_poll_add(async_uring_t *uring, uint64_t user_data, int fd,
+                         uint32_t poll_mask, bool multishot);
+int async_uring_poll_remove(async_uring_t *uring, uint64_t user_data);
+
+/* Submit the queued requests and wait for at most ns nanoseconds
+ * (indefinitely if ns is negative) for a completion. Return the number
+ * of completions available or a negative number in case of an
+ * error. */
+int async_uring_enter(async_uring_t *uring, int64_t ns);
+
+/* Return false if no completion is available. */
+bool async_uring_reap(async_uring_t *uring,
+                      async_uring_completion_t *completion);
+#endif
@@ -0,0 +1,74 @@
+#ifndef __MULTILOOP__
+#define __MULTILOOP__
+
+#include <sys/socket.h>
+
+#include "async.h"
+#include "tcp_connection.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A multiloop runs a service on several cores. Each of its shards is a
+ * thread with a private async_t and a private SO_REUSEPORT listening
+ * socket bound to a common address. The kernel distributes incoming
+ * connections between the listening sockets so the shards share no
+ * state on the hot path.
+ */
+typedef struct multiloop multiloop_t;
+
+enum {
+    /* Pin each shard thread to a CPU of its own (as far as the
+     * available CPUs go). Linux only. */
+    MULTILOOP_PIN_THREADS = 0x1,
+    /* Hand a connection to the shard pinned to the CPU that received
+     * it. Implies MULTILOOP_PIN_THREADS. Each shard needs a CPU of its
+     * own: make_multiloop() fails with EINVAL if there are more shards
+     * than CPUs available to the process. Linux only. */
+    MULTILOOP_STEER_BY_CPU = 0x2,
+};
+
+typedef struct {
+    void *obj;
+    /* Called in the shard thread before its loop is entered. The
+     * server takes the ownership of the shard's listening socket and
+     * is handed over to the callee, who can use it directly or pass it
+     * on to, e.g., open_jsonserver(). */
+    void (*start)(void *obj, unsigned shard, async_t *async,
+                  tcp_server_t *server);
+    /* Called in the shard thread after its loop has quit. Everything
+     * created by start() should be released here, as the shard's
+     * async_t is destroyed right after. May be NULL. */
+    void (*stop)(void *obj, unsigned shard, async_t *async);
+} multiloop_handler_t;
+
+/* Open shard_count listening sockets bound to address and start a
+ * thread for each. If the port of address is 0, the first socket gets
+ * an ephemeral port and the rest are bound to the same one (see
+ * multiloop_get_address()). Flags is a combination of the MULTILOOP_*
+ * values above. Return NULL and set errno in case of an error. */
+multiloop_t *make_multiloop(const struct sockaddr *address,
+                            socklen_t addrlen, unsigned shard_count,
+                            unsigned flags, multiloop_handler_t handler);
+
+/* Stop the shard loops, wait for the threads to exit and release the
+ * resources. Must not be called from a shard thread. */
+void destroy_multiloop(multiloop_t *multiloop);
+
+unsigned multiloop_get_shard_count(multiloop_t *multiloop);
+
+/* The returned async_t belongs to the shard thread. Other threads may
+ * only use it with async_execute_remote(). */
+async_t *multiloop_get_async(multiloop_t *multiloop, unsigned shard);
+
+/* Return the address shared by the listening sockets. */
+const struct sockaddr *multiloop_get_address(multiloop_t *multiloop,
+                                             socklen_t *addrlen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
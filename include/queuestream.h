@@ -70,6 +70,12 @@ void queuestream_push_bytes(queuestream_t *qstr, const void *blob,
  * before queuestream_read() has returned 0 for an EOF. */
 void queuestream_terminate(queuestream_t *qstr);
 
+/* Postpone notifying the consumer of new data until the loop is about
+ * to wait for I/O (see async_add_prepare_hook()). The streams enqueued
+ * during an iteration can then be read, and typically written to a
+ * socket, in one go. */
+void queuestream_coalesce(queuestream_t *qstr);
+
 bytestream_1 queuestream_as_bytestream_1(queuestream_t *qstr);
 ssize_t queuestream_read(queuestream_t *qstr, void *buf, size_t count);
 void queuestream_close(queuestream_t *qstr);
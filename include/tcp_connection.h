@@ -28,6 +28,7 @@ enum {
     TCP_FLAG_EPOLL_SEND = 0x08,      /* send returned EAGAIN */
     TCP_FLAG_INGRESS_PENDING = 0x10, /* waiting for tcp_read to be called */
     TCP_FLAG_EGRESS_PENDING = 0x20,  /* wtng for notific'n from outstrm */
+    TCP_FLAG_MIGRATING = 0x40,       /* see tcp_conn_migrate() */
 };
 
 typedef struct {
@@ -42,6 +43,22 @@ tcp_conn_t *tcp_adopt_connection(async_t *async, int connfd);
 
 void tcp_get_statistics_1(tcp_conn_t *conn, tcp_statistics_1 *stats);
 
+/* Hand the connection over to another async_t, which is typically
+ * run by another thread. Must be called from the thread of the current
+ * async_t. The handover is asynchronous: from the call on, the caller
+ * must not touch the connection until action is performed in the
+ * target loop. No I/O takes place in the meantime, and the readiness
+ * of the socket is probed afresh in the target loop.
+ *
+ * Received ancillary data and pending tcp_mark_ancillary_data()
+ * callbacks move along with the connection; the latter are scheduled
+ * in the target loop. The byte streams attached to the connection,
+ * however, are user objects and must be usable in the target loop.
+ * Usually, the connection is migrated before any streams are attached
+ * to it, or action replaces them with ones created in the target
+ * loop. */
+void tcp_conn_migrate(tcp_conn_t *conn, async_t *target, action_1 action);
+
 /* Close the connection and release the resources associated with it.
  * If the output stream is still open, an immediate close is
  * performed. If the input stream is still open, it is shut down, but
@@ -2,7 +2,13 @@
 #include <unistd.h>
 #ifdef __linux__
 #define USE_EPOLL 1
+#include <poll.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#ifdef __NR_epoll_pwait2
+#include <linux/time_types.h>
+#endif
 #else /* assume BSD */
 #define USE_EPOLL 0
 #include <sys/event.h>
@@ -19,6 +25,9 @@
 #endif
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -49,15 +58,6 @@ static void timer_reloc(const void *t, void *loc)
     ((async_timer_t *) t)->loc = loc;
 }
 
-static int intptr_cmp(const void *i1, const void *i2)
-{
-    if ((intptr_t) i1 < (intptr_t) i2)
-        return -1;
-    if ((intptr_t) i1 > (intptr_t) i2)
-        return 1;
-    return 0;
-}
-
 static int cloexec(int fd)
 {
     int status = fcntl(fd, F_GETFD, 0);
@@ -74,15 +74,28 @@ int async_nonblock(int fd)
     return fcntl(fd, F_SETFL, status | O_NONBLOCK);
 }
 
+FSTRACE_DECL(ASYNC_URING_FALLBACK, "UID=%64u ERRNO=%e");
 FSTRACE_DECL(ASYNC_EPOLL_CREATE_FAILED, "ERRNO=%e");
 FSTRACE_DECL(ASYNC_CLOEXEC_FAILED, "ERRNO=%e");
 FSTRACE_DECL(ASYNC_CREATE, "UID=%64u PTR=%p FD=%d");
 
+static bool open_remote(async_t *async);
+static void close_remote(async_t *async);
+
 async_t *make_async(void)
 {
     async_t *async = fsalloc(sizeof *async);
     async->uid = fstrace_get_unique_id();
-#if USE_EPOLL
+#if ASYNC_IO_URING
+    int fd;
+    async->uring = async_uring_create(ASYNC_URING_ENTRIES);
+    if (async->uring)
+        fd = async_uring_fd(async->uring);
+    else {
+        FSTRACE(ASYNC_URING_FALLBACK, async->uid);
+        fd = epoll_create(1);
+    }
+#elif USE_EPOLL
     int fd = epoll_create(1);
 #else
     int fd = kqueue();
@@ -94,45 +107,375 @@ async_t *make_async(void)
     }
     if (cloexec(fd) < 0) {
         FSTRACE(ASYNC_CLOEXEC_FAILED);
+#if ASYNC_IO_URING
+        if (async->uring)
+            async_uring_destroy(async->uring); /* closes fd */
+        else
+#endif
+            (void) close(fd);
         fsfree(async);
         return NULL;
     }
 
     FSTRACE(ASYNC_CREATE, async->uid, async, fd);
     async->poll_fd = fd;
-    async->immediate = make_list();
+    memset(async->immediate, 0, sizeof async->immediate);
+    memset(async->immediate_tail, 0, sizeof async->immediate_tail);
+    memset(async->passed_over, 0, sizeof async->passed_over);
+    async->immediate_count = 0;
     async->timers = make_priority_queue(timer_cmp, timer_reloc);
-    async->registrations = make_avl_tree(intptr_cmp);
+    async->timed_floor = -1;
+    async->wheel_enabled = true;
+    async->high_resolution = false;
+    memset(async->wheel, 0, sizeof async->wheel);
+    async->spare_timers = NULL;
+    async->spare_timer_count = 0;
+    async->registrations = NULL;
+    async->registration_capacity = 0;
+    async->policy = (async_policy_t) {
+        .io_burst = ASYNC_DEFAULT_IO_BURST,
+        .callback_budget = ASYNC_DEFAULT_CALLBACK_BUDGET,
+    };
+    async->io_burst = async->policy.io_burst;
+    async->small_batches = 0;
+    async->io_events = NULL;
+    async->io_event_capacity = 0;
+    memset(&async->stats, 0, sizeof async->stats);
+    async->iteration_started = async->wait_started = 0;
+    async->profile_period = async->profile_countdown = 0;
+    async->profile = NULL;
+    async->profile_capacity = async->profile_size = 0;
+    async->watchdog = NULL;
+    async->offload = NULL;
+    async->offload_threads = ASYNC_OFFLOAD_THREADS;
+    async->remote = NULL;
+    async->remote_readfd = async->remote_writefd = -1;
     async_initialize_wakeup(async);
-    async->wounded_objects = make_list();
+    async->wounded = NULL;
+    async->wounded_count = async->wounded_capacity = 0;
+    async->prepare_hooks.first = async->prepare_hooks.last = NULL;
+    async->check_hooks.first = async->check_hooks.last = NULL;
+    async->hook_cursor = NULL;
 #ifdef __MACH__
     host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &async->mach_clock);
 #endif
     (void) async_now(async); /* initialize async->recent */
+    async->wheel_tick = async->recent >> ASYNC_WHEEL_TICK_SHIFT;
+    if (!open_remote(async)) {
+        destroy_async(async);
+        return NULL;
+    }
     return async;
 }
 
+void async_disable_timing_wheel(async_t *async)
+{
+    async->wheel_enabled = false;
+}
+
+void async_enable_high_resolution(async_t *async)
+{
+    async->high_resolution = true;
+}
+
+bool async_uses_io_uring(async_t *async)
+{
+#if ASYNC_IO_URING
+    return async->uring != NULL;
+#else
+    return false;
+#endif
+}
+
+void async_get_policy(async_t *async, async_policy_t *policy)
+{
+    *policy = async->policy;
+}
+
+FSTRACE_DECL(ASYNC_SET_POLICY,
+             "UID=%64u IO-BURST=%u BUDGET=%u ADAPTIVE=%b MAX-IO-BURST=%u");
+FSTRACE_DECL(ASYNC_SET_POLICY_FAIL, "UID=%64u ERRNO=%e");
+
+int async_set_policy(async_t *async, const async_policy_t *policy)
+{
+    if (policy->io_burst == 0 || policy->callback_budget == 0 ||
+        (policy->adaptive && policy->max_io_burst < policy->io_burst)) {
+        errno = EINVAL;
+        FSTRACE(ASYNC_SET_POLICY_FAIL, async->uid);
+        return -1;
+    }
+    FSTRACE(ASYNC_SET_POLICY, async->uid, policy->io_burst,
+            policy->callback_budget, policy->adaptive, policy->max_io_burst);
+    async->policy = *policy;
+    async->io_burst = policy->io_burst;
+    async->small_batches = 0;
+    return 0;
+}
+
+static uint64_t wheel_span(int level)
+{
+    return (uint64_t) 1 << ASYNC_WHEEL_LEVEL_BITS * level;
+}
+
+static unsigned wheel_slot(uint64_t tick, int level)
+{
+    return tick >> ASYNC_WHEEL_LEVEL_BITS * level & (ASYNC_WHEEL_SLOTS - 1);
+}
+
+static void wheel_link(async_t *async, async_timer_t *timer, int level)
+{
+    async_wheel_level_t *wl = &async->wheel[level];
+    unsigned slot = wheel_slot(timer->expires >> ASYNC_WHEEL_TICK_SHIFT, level);
+    async_timer_t *head = wl->slots[slot];
+    if (head == NULL) {
+        timer->prev = timer->next = timer;
+        wl->slots[slot] = timer;
+        wl->occupied |= (uint64_t) 1 << slot;
+    } else {
+        timer->prev = head->prev;
+        timer->next = head;
+        head->prev->next = timer;
+        head->prev = timer;
+    }
+    timer->level = level;
+}
+
+static void wheel_unlink(async_t *async, async_timer_t *timer)
+{
+    async_wheel_level_t *wl = &async->wheel[timer->level];
+    unsigned slot =
+        wheel_slot(timer->expires >> ASYNC_WHEEL_TICK_SHIFT, timer->level);
+    if (timer->next == timer) {
+        wl->slots[slot] = NULL;
+        wl->occupied &= ~((uint64_t) 1 << slot);
+    } else {
+        timer->prev->next = timer->next;
+        timer->next->prev = timer->prev;
+        if (wl->slots[slot] == timer)
+            wl->slots[slot] = timer->next;
+    }
+    timer->level = -1;
+}
+
+/* Place the timer in the timing wheel if it isn't due yet at the
+ * current tick and fits in the wheel. Otherwise, place it in the
+ * priority queue. */
+static void store_timer(async_t *async, async_timer_t *timer)
+{
+    uint64_t tick = timer->expires >> ASYNC_WHEEL_TICK_SHIFT;
+    if (async->wheel_enabled && tick > async->wheel_tick) {
+        uint64_t delta = tick - async->wheel_tick;
+        int level;
+        for (level = 0; level < ASYNC_WHEEL_LEVELS; level++)
+            if (delta < wheel_span(level + 1)) {
+                wheel_link(async, timer, level);
+                return;
+            }
+    }
+    timer->level = -1;
+    priorq_enqueue(async->timers, timer);
+    if (timer->expires < async->timed_floor)
+        async->timed_floor = timer->expires;
+}
+
+/* Return the tick at which the wheel reaches the next nonempty slot of
+ * the given level or (uint64_t) -1 if the level is empty. */
+static uint64_t wheel_next_visit(async_t *async, int level)
+{
+    uint64_t occupied = async->wheel[level].occupied;
+    if (!occupied)
+        return -1;
+    uint64_t turn = async->wheel_tick >> ASYNC_WHEEL_LEVEL_BITS * level;
+    unsigned current = turn & (ASYNC_WHEEL_SLOTS - 1);
+    uint64_t ahead = occupied & ~(((uint64_t) 2 << current) - 1);
+    turn &= ~(uint64_t) (ASYNC_WHEEL_SLOTS - 1);
+    if (ahead)
+        turn += __builtin_ctzll(ahead);
+    else
+        turn += ASYNC_WHEEL_SLOTS + __builtin_ctzll(occupied);
+    return turn << ASYNC_WHEEL_LEVEL_BITS * level;
+}
+
+static uint64_t wheel_next_tick(async_t *async)
+{
+    uint64_t next = -1;
+    int level;
+    for (level = 0; level < ASYNC_WHEEL_LEVELS; level++) {
+        uint64_t visit = wheel_next_visit(async, level);
+        if (visit < next)
+            next = visit;
+    }
+    return next;
+}
+
+static void cascade(async_t *async, int level, unsigned slot)
+{
+    async_wheel_level_t *wl = &async->wheel[level];
+    async_timer_t *timer = wl->slots[slot];
+    wl->slots[slot] = NULL;
+    wl->occupied &= ~((uint64_t) 1 << slot);
+    timer->prev->next = NULL;
+    while (timer) {
+        async_timer_t *next = timer->next;
+        store_timer(async, timer);
+        timer = next;
+    }
+}
+
+/* Turn the timing wheel up to the given point in time. Afterwards,
+ * every timer that is due at that time is in async->timers. */
+static void turn_wheel(async_t *async, uint64_t now)
+{
+    uint64_t target = now >> ASYNC_WHEEL_TICK_SHIFT;
+    while (async->wheel_tick < target) {
+        uint64_t visits[ASYNC_WHEEL_LEVELS];
+        uint64_t next = -1;
+        int level;
+        for (level = 0; level < ASYNC_WHEEL_LEVELS; level++) {
+            visits[level] = wheel_next_visit(async, level);
+            if (visits[level] < next)
+                next = visits[level];
+        }
+        if (next > target) {
+            async->wheel_tick = target;
+            return;
+        }
+        async->wheel_tick = next;
+        for (level = ASYNC_WHEEL_LEVELS - 1; level >= 0; level--)
+            if (visits[level] == next)
+                cascade(async, level, wheel_slot(next, level));
+    }
+}
+
+/* Return the head of the highest-priority nonempty immediate FIFO
+ * unless a lower-priority FIFO has been passed over too many times. */
+static async_timer_t *next_immediate(async_t *async)
+{
+    async_timer_t *next = NULL;
+    int prio;
+    for (prio = ASYNC_PRIO_LEVELS - 1; prio >= 0; prio--) {
+        async_timer_t *head = async->immediate[prio];
+        if (!head)
+            continue;
+        if (async->passed_over[prio] >= ASYNC_PRIO_STARVATION_LIMIT)
+            return head;
+        next = head;
+    }
+    return next;
+}
+
+/* Return the earliest timer outside the timing wheel. Call
+ * turn_wheel() first to make sure no due timer is left in the wheel.
+ *
+ * The priority queue is not consulted while immediate work is pending
+ * and async->timed_floor shows no timer in the queue can precede it. */
 static async_timer_t *earliest_timer(async_t *async)
 {
+    async_timer_t *immediate = next_immediate(async);
+    if (immediate && immediate->expires < async->timed_floor)
+        return immediate;
     async_timer_t *timed = (async_timer_t *) priorq_peek(async->timers);
-    if (list_empty(async->immediate))
-        return timed;
-    async_timer_t *immediate =
-        (async_timer_t *) list_elem_get_value(list_get_first(async->immediate));
-    if (timed && timer_cmp(timed, immediate) < 0)
+    async->timed_floor = timed ? timed->expires : (uint64_t) -1;
+    if (!immediate || (timed && timer_cmp(timed, immediate) < 0))
         return timed;
     return immediate;
 }
 
-static void finish_wounded_object(async_t *async)
+static void immediate_append(async_t *async, async_timer_t *timer)
+{
+    async_prio_t prio = timer->prio;
+    timer->prev = async->immediate_tail[prio];
+    timer->next = NULL;
+    if (async->immediate_tail[prio])
+        async->immediate_tail[prio]->next = timer;
+    else
+        async->immediate[prio] = timer;
+    async->immediate_tail[prio] = timer;
+    async->immediate_count++;
+}
+
+static void immediate_remove(async_t *async, async_timer_t *timer)
+{
+    async_prio_t prio = timer->prio;
+    if (timer->prev)
+        timer->prev->next = timer->next;
+    else
+        async->immediate[prio] = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
+    else
+        async->immediate_tail[prio] = timer->prev;
+    async->immediate_count--;
+}
+
+/* Return the point in time by which the next timer might expire or
+ * (uint64_t) -1 if there are no timers. The earliest timer outside the
+ * timing wheel is given as an argument (or NULL). */
+static uint64_t next_expiry(async_t *async, async_timer_t *timer)
+{
+    uint64_t expires = timer ? timer->expires : (uint64_t) -1;
+    uint64_t tick = wheel_next_tick(async);
+    if (tick != (uint64_t) -1 && tick << ASYNC_WHEEL_TICK_SHIFT < expires)
+        return tick << ASYNC_WHEEL_TICK_SHIFT;
+    return expires;
+}
+
+static async_timer_t *any_timer(async_t *async)
+{
+    async_timer_t *timer = earliest_timer(async);
+    if (timer)
+        return timer;
+    int level;
+    for (level = 0; level < ASYNC_WHEEL_LEVELS; level++) {
+        async_wheel_level_t *wl = &async->wheel[level];
+        if (wl->occupied)
+            return wl->slots[__builtin_ctzll(wl->occupied)];
+    }
+    return NULL;
+}
+
+/* Return the smallest seqno of the pending immediate tasks or
+ * (uint64_t) -1 if there are none. Each immediate FIFO is in the order
+ * of seqnos. */
+static uint64_t immediate_floor(async_t *async)
+{
+    uint64_t floor = -1;
+    int prio;
+    for (prio = 0; prio < ASYNC_PRIO_LEVELS; prio++) {
+        async_timer_t *head = async->immediate[prio];
+        if (head && head->seqno < floor)
+            floor = head->seqno;
+    }
+    return floor;
+}
+
+FSTRACE_DECL(ASYNC_RECLAIM, "UID=%64u COUNT=%z LEFT=%z");
+
+/* Free the wounded objects that were wounded before every pending
+ * immediate task was scheduled. Called once per loop iteration, when no
+ * callback is in progress. */
+static void reclaim_wounded_objects(async_t *async)
 {
-    fsfree((void *) list_pop_first(async->wounded_objects));
+    if (!async->wounded_count)
+        return;
+    uint64_t floor = immediate_floor(async);
+    size_t n = 0;
+    while (n < async->wounded_count && async->wounded[n].seqno < floor)
+        fsfree(async->wounded[n++].object);
+    if (n == 0)
+        return;
+    async->wounded_count -= n;
+    memmove(async->wounded, async->wounded + n,
+            async->wounded_count * sizeof *async->wounded);
+    FSTRACE(ASYNC_RECLAIM, async->uid, n, async->wounded_count);
 }
 
 static void finish_wounded_objects(async_t *async)
 {
-    while (!list_empty(async->wounded_objects))
-        finish_wounded_object(async);
+    size_t i;
+    for (i = 0; i < async->wounded_count; i++)
+        fsfree(async->wounded[i].object);
+    async->wounded_count = 0;
 }
 
 FSTRACE_DECL(ASYNC_DESTROY, "UID=%64u");
@@ -140,61 +483,177 @@ FSTRACE_DECL(ASYNC_DESTROY, "UID=%64u");
 void destroy_async(async_t *async)
 {
     FSTRACE(ASYNC_DESTROY, async->uid);
+    if (async->offload)
+        async_offload_destroy(async->offload);
     async_dismantle_wakeup(async);
     async_timer_t *timer;
-    while ((timer = earliest_timer(async)) != NULL)
+    while ((timer = any_timer(async)) != NULL)
         async_timer_cancel(async, timer);
     destroy_priority_queue(async->timers);
-    destroy_list(async->immediate);
-    avl_elem_t *element;
-    while ((element = avl_tree_get_first(async->registrations)) != NULL) {
-        int fd = (intptr_t) avl_elem_get_key(element);
-        async_unregister(async, fd);
+    while (async->spare_timers) {
+        timer = async->spare_timers;
+        async->spare_timers = timer->next;
+        fsfree(timer);
     }
-    destroy_avl_tree(async->registrations);
+    int fd;
+    for (fd = 0; fd < async->registration_capacity; fd++)
+        if (async->registrations[fd].registered)
+            async_unregister(async, fd);
+    fsfree(async->registrations);
+    fsfree(async->io_events);
+    close_remote(async);
 #ifdef __MACH__
     mach_port_deallocate(mach_task_self(), async->mach_clock);
 #endif
-    (void) close(async->poll_fd);
+#if ASYNC_IO_URING
+    if (async->uring)
+        async_uring_destroy(async->uring); /* closes async->poll_fd */
+    else
+#endif
+        (void) close(async->poll_fd);
     finish_wounded_objects(async);
-    destroy_list(async->wounded_objects);
+    fsfree(async->wounded);
+    while (async->prepare_hooks.first)
+        async_remove_hook(async, async->prepare_hooks.first);
+    while (async->check_hooks.first)
+        async_remove_hook(async, async->check_hooks.first);
+    fsfree(async->profile);
+    if (async->watchdog)
+        async_watchdog_destroy(async->watchdog);
     fsfree(async);
 }
 
 FSTRACE_DECL(ASYNC_NOW, "UID=%64u TIME=%64u");
 
-uint64_t async_now(async_t *async)
+static uint64_t read_clock(async_t *async)
 {
 #if defined(CLOCK_MONOTONIC)
     struct timespec t;
     clock_gettime(CLOCK_MONOTONIC, &t);
-    async->recent = (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
 #elif defined(__MACH__)
     mach_timespec_t t;
     clock_get_time(async->mach_clock, &t);
-    async->recent = (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
 #else
     struct timeval t;
     gettimeofday(&t, NULL);
-    async->recent = (uint64_t) t.tv_sec * 1000000000 + t.tv_usec * 1000;
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_usec * 1000;
 #endif
+}
+
+uint64_t async_now(async_t *async)
+{
+    async->recent = read_clock(async);
     FSTRACE(ASYNC_NOW, async->uid, async->recent);
     return async->recent;
 }
 
+uint64_t async_recent(async_t *async)
+{
+    return async->recent;
+}
+
+/* The loop is the only writer of the statistics so no atomic
+ * read-modify-write is needed. The atomic accesses merely keep
+ * async_get_stats() from seeing torn values. */
+static void stats_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+static void histogram_add(async_histogram_t *histogram, uint64_t value)
+{
+    unsigned n = value ? 64 - __builtin_clzll(value) : 0;
+    if (n >= ASYNC_STATS_BUCKETS)
+        n = ASYNC_STATS_BUCKETS - 1;
+    stats_add(&histogram->bucket[n], 1);
+}
+
+void async_get_stats(async_t *async, async_stats_t *stats)
+{
+    const uint64_t *from = (const uint64_t *) &async->stats;
+    uint64_t *to = (uint64_t *) stats;
+    size_t i;
+    for (i = 0; i < sizeof *stats / sizeof *to; i++)
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
+
+/* Called at the start of a loop iteration after the clock has been
+ * read. */
+static void account_iteration(async_t *async, uint64_t now)
+{
+    async_stats_t *stats = &async->stats;
+    if (async->iteration_started) {
+        uint64_t blocked = 0;
+        if (async->wait_started)
+            blocked = now - async->wait_started;
+        stats_add(&stats->blocked_ns, blocked);
+        stats_add(&stats->busy_ns, now - async->iteration_started - blocked);
+    }
+    async->iteration_started = now;
+    async->wait_started = 0;
+    stats_add(&stats->iterations, 1);
+    histogram_add(&stats->immediate_depth, async->immediate_count);
+}
+
+static void account_dispatch(async_t *async, async_timer_t *timer,
+                             uint64_t now)
+{
+    stats_add(&async->stats.callbacks, 1);
+    if (!timer->immediate) {
+        histogram_add(&async->stats.timer_lateness, now - timer->expires);
+        return;
+    }
+    /* Count how many times the lower-priority FIFOs get passed over. */
+    async->passed_over[timer->prio] = 0;
+    int prio;
+    for (prio = timer->prio + 1; prio < ASYNC_PRIO_LEVELS; prio++)
+        if (async->immediate[prio])
+            async->passed_over[prio]++;
+}
+
 enum {
     BT_DEPTH = 31,
 };
 
 FSTRACE_DECL(ASYNC_TIMER_BT, "UID=%64u BT=%s");
 
-static async_timer_t *new_timer(async_t *async, bool immediate,
-                                uint64_t expires, action_1 action)
+/* Timer objects are recycled through a bounded free list so the
+ * allocator stays out of the dispatch path. */
+static async_timer_t *alloc_timer(async_t *async)
+{
+    async_timer_t *timer = async->spare_timers;
+    if (timer == NULL)
+        return fsalloc(sizeof *timer);
+    async->spare_timers = timer->next;
+    async->spare_timer_count--;
+    return timer;
+}
+
+static void free_timer(async_t *async, async_timer_t *timer)
+{
+    fsfree(timer->stack_trace);
+    if (async->spare_timer_count >= ASYNC_MAX_SPARE_TIMERS) {
+        fsfree(timer);
+        return;
+    }
+    timer->next = async->spare_timers;
+    async->spare_timers = timer;
+    async->spare_timer_count++;
+}
+
+static void init_timer(async_timer_t *timer, bool immediate,
+                       uint64_t expires, action_1 action)
 {
-    async_timer_t *timer = fsalloc(sizeof *timer);
     timer->expires = expires;
     timer->seqno = fstrace_get_unique_id();
     timer->immediate = immediate;
+    timer->prio = ASYNC_PRIO_NORMAL;
+    timer->armed = true;
+    timer->period = 0;
+    timer->level = -1;
     timer->action = action;
     timer->stack_trace = NULL;
 #ifdef HAVE_EXECINFO
@@ -203,6 +662,14 @@ static async_timer_t *new_timer(async_t *async, bool immediate,
         backtrace(timer->stack_trace, BT_DEPTH);
     }
 #endif
+}
+
+static async_timer_t *new_timer(async_t *async, bool immediate,
+                                uint64_t expires, action_1 action)
+{
+    async_timer_t *timer = alloc_timer(async);
+    timer->embedded = false;
+    init_timer(timer, immediate, expires, action);
     return timer;
 }
 
@@ -210,7 +677,7 @@ static async_timer_t *timer_start(async_t *async, uint64_t expires,
                                   action_1 action)
 {
     async_timer_t *timer = new_timer(async, false, expires, action);
-    priorq_enqueue(async->timers, timer);
+    store_timer(async, timer);
     async_wake_up(async);
     return timer;
 }
@@ -227,14 +694,46 @@ async_timer_t *async_timer_start(async_t *async, uint64_t expires,
     return timer;
 }
 
+/* Return the latest point in [expires, expires + slack] that is a
+ * multiple of the largest power of two not exceeding slack. */
+static uint64_t apply_slack(uint64_t expires, uint64_t slack)
+{
+    if (slack > (uint64_t) -1 - expires)
+        slack = (uint64_t) -1 - expires;
+    if (slack == 0)
+        return expires;
+    uint64_t grain = (uint64_t) 1 << (63 - __builtin_clzll(slack));
+    return (expires + slack) & ~(grain - 1);
+}
+
+FSTRACE_DECL(ASYNC_TIMER_START_SLACK,
+             "UID=%64u PTR=%p ASYNC=%64u EXPIRES=%64u SLACK=%64u "
+             "OBJ=%p ACT=%p");
+
+async_timer_t *async_timer_start_slack(async_t *async, uint64_t expires,
+                                       uint64_t slack, action_1 action)
+{
+    async_timer_t *timer =
+        timer_start(async, apply_slack(expires, slack), action);
+    FSTRACE(ASYNC_TIMER_START_SLACK, timer->seqno, timer, async->uid,
+            expires, slack, action.obj, action.act);
+    return timer;
+}
+
 static void timer_cancel(async_t *async, async_timer_t *timer)
 {
     if (timer->immediate)
-        list_remove(async->immediate, timer->loc);
+        immediate_remove(async, timer);
+    else if (timer->level >= 0)
+        wheel_unlink(async, timer);
     else
         priorq_remove(async->timers, timer->loc);
-    fsfree(timer->stack_trace);
-    fsfree(timer);
+    timer->armed = false;
+    if (timer->embedded) {
+        fsfree(timer->stack_trace);
+        timer->stack_trace = NULL;
+    } else
+        free_timer(async, timer);
 }
 
 FSTRACE_DECL(ASYNC_TIMER_CANCEL, "UID=%64u");
@@ -245,6 +744,93 @@ void async_timer_cancel(async_t *async, async_timer_t *timer)
     timer_cancel(async, timer);
 }
 
+void async_timer_init(async_timer_t *timer, action_1 action)
+{
+    timer->seqno = fstrace_get_unique_id();
+    timer->embedded = true;
+    timer->armed = false;
+    timer->period = 0;
+    timer->action = action;
+    timer->stack_trace = NULL;
+}
+
+static void arm_timer(async_t *async, async_timer_t *timer, uint64_t expires,
+                      uint64_t period)
+{
+    if (timer->armed)
+        timer_cancel(async, timer);
+    init_timer(timer, false, expires, timer->action);
+    timer->period = period;
+    store_timer(async, timer);
+    async_wake_up(async);
+}
+
+FSTRACE_DECL(ASYNC_TIMER_REARM, "UID=%64u PTR=%p ASYNC=%64u EXPIRES=%64u");
+
+void async_timer_rearm(async_t *async, async_timer_t *timer,
+                       uint64_t expires)
+{
+    assert(timer->embedded);
+    arm_timer(async, timer, expires, 0);
+    FSTRACE(ASYNC_TIMER_REARM, timer->seqno, timer, async->uid, expires);
+}
+
+FSTRACE_DECL(ASYNC_TIMER_REARM_SLACK,
+             "UID=%64u PTR=%p ASYNC=%64u EXPIRES=%64u SLACK=%64u");
+
+void async_timer_rearm_slack(async_t *async, async_timer_t *timer,
+                             uint64_t expires, uint64_t slack)
+{
+    assert(timer->embedded);
+    arm_timer(async, timer, apply_slack(expires, slack), 0);
+    FSTRACE(ASYNC_TIMER_REARM_SLACK, timer->seqno, timer, async->uid, expires,
+            slack);
+}
+
+FSTRACE_DECL(ASYNC_TIMER_REARM_PERIODIC,
+             "UID=%64u PTR=%p ASYNC=%64u EXPIRES=%64u PERIOD=%64u");
+
+void async_timer_rearm_periodic(async_t *async, async_timer_t *timer,
+                                uint64_t expires, uint64_t period)
+{
+    assert(timer->embedded && period > 0);
+    arm_timer(async, timer, expires, period);
+    FSTRACE(ASYNC_TIMER_REARM_PERIODIC, timer->seqno, timer, async->uid,
+            expires, period);
+}
+
+FSTRACE_DECL(ASYNC_TIMER_STOP, "UID=%64u ARMED=%b");
+
+void async_timer_stop(async_t *async, async_timer_t *timer)
+{
+    assert(timer->embedded);
+    FSTRACE(ASYNC_TIMER_STOP, timer->seqno, timer->armed);
+    if (timer->armed)
+        timer_cancel(async, timer);
+}
+
+bool async_timer_armed(async_timer_t *timer)
+{
+    return timer->armed;
+}
+
+/* Take a due timer out before its action is performed. A periodic
+ * timer is put back right away, skipping the expiries that have been
+ * missed. */
+static void expire_timer(async_t *async, async_timer_t *timer, uint64_t now)
+{
+    uint64_t period = timer->period;
+    timer_cancel(async, timer);
+    if (!period)
+        return;
+    uint64_t expires = timer->expires + period;
+    if (expires <= now)
+        expires += (now - expires) / period * period + period;
+    init_timer(timer, false, expires, timer->action);
+    timer->period = period;
+    store_timer(async, timer);
+}
+
 FSTRACE_DECL(ASYNC_EVENT_CREATE, "UID=%64u PTR=%p ASYNC=%64u OBJ=%p ACT=%p");
 
 async_event_t *make_async_event(async_t *async, action_1 action)
@@ -256,7 +842,11 @@ async_event_t *make_async_event(async_t *async, action_1 action)
             action.act);
     event->state = ASYNC_EVENT_IDLE;
     event->action = action;
+    event->io_action = (async_io_action) { NULL, NULL };
+    event->readiness = 0;
     event->stack_trace = NULL;
+    event->link.embedded = true;
+    event->link.stack_trace = NULL;
     return event;
 }
 
@@ -290,13 +880,19 @@ FSTRACE_DECL(ASYNC_EVENT_PERF, "UID=%64u");
 static void event_perf(async_event_t *event)
 {
     FSTRACE(ASYNC_EVENT_PERF, event->uid);
+    unsigned readiness = event->readiness;
     switch (event->state) {
         case ASYNC_EVENT_TRIGGERED:
             event_set_state(event, ASYNC_EVENT_IDLE);
-            action_1_perf(event->action);
+            event->readiness = 0;
+            if (event->io_action.act)
+                event->io_action.act(event->io_action.obj, readiness);
+            else
+                action_1_perf(event->action);
             break;
         case ASYNC_EVENT_CANCELED:
             event_set_state(event, ASYNC_EVENT_IDLE);
+            event->readiness = 0;
             break;
         case ASYNC_EVENT_ZOMBIE:
             fsfree(event);
@@ -314,8 +910,10 @@ void async_event_trigger(async_event_t *event)
     switch (event->state) {
         case ASYNC_EVENT_IDLE:
             event_set_state(event, ASYNC_EVENT_TRIGGERED);
-            async_execute(event->async,
-                          (action_1) { event, (act_1) event_perf });
+            init_timer(&event->link, true, event->async->recent,
+                       (action_1) { event, (act_1) event_perf });
+            immediate_append(event->async, &event->link);
+            async_wake_up(event->async);
             break;
         case ASYNC_EVENT_TRIGGERED:
             break;
@@ -327,6 +925,42 @@ void async_event_trigger(async_event_t *event)
     }
 }
 
+#if USE_EPOLL
+static unsigned epoll_readiness(uint32_t events)
+{
+    unsigned readiness = 0;
+    if (events & EPOLLIN)
+        readiness |= ASYNC_READABLE;
+    if (events & EPOLLOUT)
+        readiness |= ASYNC_WRITABLE;
+    if (events & (EPOLLHUP | EPOLLRDHUP))
+        readiness |= ASYNC_HANGUP;
+    if (events & EPOLLERR)
+        readiness |= ASYNC_ERROR;
+    return readiness;
+}
+#else
+static unsigned kevent_readiness(const struct kevent *kq_event)
+{
+    unsigned readiness = 0;
+    if (kq_event->filter == EVFILT_READ)
+        readiness |= ASYNC_READABLE;
+    else if (kq_event->filter == EVFILT_WRITE)
+        readiness |= ASYNC_WRITABLE;
+    if (kq_event->flags & EV_EOF)
+        readiness |= ASYNC_HANGUP;
+    if (kq_event->flags & EV_ERROR)
+        readiness |= ASYNC_ERROR;
+    return readiness;
+}
+#endif
+
+static void io_event_trigger(async_event_t *event, unsigned readiness)
+{
+    event->readiness |= readiness;
+    async_event_trigger(event);
+}
+
 FSTRACE_DECL(ASYNC_EVENT_CANCEL, "UID=%64u");
 
 void async_event_cancel(async_event_t *event)
@@ -338,6 +972,7 @@ void async_event_cancel(async_event_t *event)
             break;
         case ASYNC_EVENT_TRIGGERED:
             event_set_state(event, ASYNC_EVENT_CANCELED);
+            event->readiness = 0;
             break;
         default:
             assert(false);
@@ -362,10 +997,12 @@ void destroy_async_event(async_event_t *event)
     }
 }
 
-static async_timer_t *execute(async_t *async, action_1 action)
+static async_timer_t *execute(async_t *async, async_prio_t prio,
+                              action_1 action)
 {
     async_timer_t *timer = new_timer(async, true, async->recent, action);
-    timer->loc = list_append(async->immediate, timer);
+    timer->prio = prio;
+    immediate_append(async, timer);
     async_wake_up(async);
     return timer;
 }
@@ -375,114 +1012,737 @@ FSTRACE_DECL(ASYNC_EXECUTE,
 
 async_timer_t *async_execute(async_t *async, action_1 action)
 {
-    async_timer_t *timer = execute(async, action);
+    async_timer_t *timer = execute(async, ASYNC_PRIO_NORMAL, action);
     FSTRACE(ASYNC_EXECUTE, timer->seqno, timer, async, timer->expires,
             action.obj, action.act);
     return timer;
 }
 
-FSTRACE_DECL(ASYNC_WOUND, "UID=%64u PTR=%p ASYNC=%p OBJ=%p");
+FSTRACE_DECL(ASYNC_EXECUTE_PRIO,
+             "UID=%64u PTR=%p ASYNC=%p PRIO=%d EXPIRES=%64u OBJ=%p ACT=%p");
 
-void async_wound(async_t *async, void *object)
+async_timer_t *async_execute_prio(async_t *async, async_prio_t prio,
+                                  action_1 action)
 {
-    list_append(async->wounded_objects, object);
-    action_1 dealloc_cb = { async, (act_1) finish_wounded_object };
-    async_timer_t *timer = execute(async, dealloc_cb);
-    FSTRACE(ASYNC_WOUND, timer->seqno, timer, async, object);
+    assert(prio >= 0 && prio < ASYNC_PRIO_LEVELS);
+    async_timer_t *timer = execute(async, prio, action);
+    FSTRACE(ASYNC_EXECUTE_PRIO, timer->seqno, timer, async, prio,
+            timer->expires, action.obj, action.act);
+    return timer;
 }
 
-int async_fd(async_t *async)
+void async_once_init(async_once_t *once)
 {
-    return async->poll_fd;
+    once->timer = NULL;
+    once->action = NULL_ACTION_1;
 }
 
-static int64_t ns_remaining(async_t *async, async_timer_t *timer)
+static void once_perf(async_once_t *once)
 {
-    return timer->expires - async_now(async);
+    once->timer = NULL;
+    action_1_perf(once->action);
 }
 
-static char *emit_char(char *p, const char *end, char c)
+FSTRACE_DECL(ASYNC_EXECUTE_ONCE, "UID=%64u PTR=%p OBJ=%p ACT=%p");
+FSTRACE_DECL(ASYNC_EXECUTE_ONCE_PENDING, "UID=%64u PTR=%p OBJ=%p ACT=%p");
+
+void async_execute_once(async_t *async, async_once_t *once, action_1 action)
 {
-    if (p < end)
-        *p++ = c;
-    return p;
+    once->action = action;
+    if (once->timer) {
+        FSTRACE(ASYNC_EXECUTE_ONCE_PENDING, async->uid, once, action.obj,
+                action.act);
+        return;
+    }
+    FSTRACE(ASYNC_EXECUTE_ONCE, async->uid, once, action.obj, action.act);
+    once->timer = execute(async, ASYNC_PRIO_NORMAL,
+                          (action_1) { once, (act_1) once_perf });
 }
 
-static char *emit_address(char *p, const char *end, void *address)
+FSTRACE_DECL(ASYNC_ONCE_CANCEL, "UID=%64u PTR=%p PENDING=%b");
+
+void async_once_cancel(async_t *async, async_once_t *once)
 {
-    char addrbuf[20];
-    snprintf(addrbuf, sizeof addrbuf, "%p", address);
-    const char *q = addrbuf;
-    while (*q)
-        p = emit_char(p, end, *q++);
-    return p;
+    FSTRACE(ASYNC_ONCE_CANCEL, async->uid, once, once->timer != NULL);
+    if (once->timer) {
+        async_timer_cancel(async, once->timer);
+        once->timer = NULL;
+    }
 }
 
-static void emit_timer_backtrace(async_timer_t *timer)
+FSTRACE_DECL(ASYNC_EXECUTE_REMOTE, "UID=%64u OBJ=%p ACT=%p");
+FSTRACE_DECL(ASYNC_EXECUTE_REMOTE_WAKEUP_FAIL, "UID=%64u ERRNO=%e");
+
+void async_execute_remote(async_t *async, action_1 action)
 {
-    enum { BUF_SIZE = BT_DEPTH * 20 };
-    char buf[BUF_SIZE];
-    const char *end = buf + BUF_SIZE - 1; /* leave room for '\0' */
-    char *p = emit_address(buf, end, timer->stack_trace[0]);
-    int i;
-    for (i = 1; i < BT_DEPTH && timer->stack_trace[i]; i++) {
-        p = emit_char(p, end, '`');
-        p = emit_address(p, end, timer->stack_trace[i]);
+    FSTRACE(ASYNC_EXECUTE_REMOTE, async->uid, action.obj, action.act);
+    async_remote_t *task = fsalloc(sizeof *task);
+    task->action = action;
+    async_remote_t *head = __atomic_load_n(&async->remote, __ATOMIC_RELAXED);
+    do
+        task->next = head;
+    while (!__atomic_compare_exchange_n(&async->remote, &head, task, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    if (!head) {
+        /* The loop takes all tasks at once, so only the first task of a
+         * batch needs to wake it up. */
+        uint64_t one = 1;
+        while (write(async->remote_writefd, &one, sizeof one) < 0)
+            if (errno != EINTR) {
+                /* EAGAIN means a wakeup is pending already. */
+                if (errno != EAGAIN)
+                    FSTRACE(ASYNC_EXECUTE_REMOTE_WAKEUP_FAIL, async->uid);
+                break;
+            }
     }
-    *p = '\0';
-    FSTRACE(ASYNC_TIMER_BT, timer->seqno, buf);
 }
 
-FSTRACE_DECL(ASYNC_POLL_NO_TIMERS, "UID=%64u");
-FSTRACE_DECL(ASYNC_POLL_TIMEOUT, "UID=%64u OBJ=%p ACT=%p");
-FSTRACE_DECL(ASYNC_POLL_NEXT_TIMER, "UID=%64u EXPIRES=%64u");
-FSTRACE_DECL(ASYNC_POLL_FAIL, "UID=%64u ERRNO=%e");
-FSTRACE_DECL(ASYNC_POLL_SPURIOUS, "UID=%64u");
-FSTRACE_DECL(ASYNC_POLL_CALL_BACK, "UID=%64u EVENT=%64u");
-FSTRACE_DECL(ASYNC_POLL_SKIP_SENTINEL, "UID=%64u");
+FSTRACE_DECL(ASYNC_TAKE_REMOTE_TASKS, "UID=%64u COUNT=%u");
 
-int async_poll(async_t *async, uint64_t *pnext_timeout)
+static void take_remote_tasks(async_t *async, unsigned readiness)
 {
-    if (!async_set_up_wakeup(async))
-        return -1;
-    async_timer_t *timer = earliest_timer(async);
-    if (timer == NULL) {
-        *pnext_timeout = (uint64_t) -1;
-        async_cancel_wakeup(async);   /* not absolutely necessary */
-        FSTRACE(ASYNC_POLL_NO_TIMERS, async->uid);
-    } else {
-        if (ns_remaining(async, timer) <= 0) {
-            action_1 action = timer->action;
-            FSTRACE(ASYNC_POLL_TIMEOUT, timer->seqno, timer->action.obj,
-                    timer->action.act);
-            if (FSTRACE_ENABLED(ASYNC_TIMER_BT) && timer->stack_trace)
-                emit_timer_backtrace(timer);
-            timer_cancel(async, timer);
-            action_1_perf(action);
-            *pnext_timeout = 0;
-            return 0;
-        }
-        FSTRACE(ASYNC_POLL_NEXT_TIMER, async->uid, timer->expires);
-        *pnext_timeout = timer->expires;
+    /* Read the file descriptor before emptying the list; a task pushed
+     * in between then writes to it anew. */
+    uint64_t buf[8];
+    while (read(async->remote_readfd, buf, sizeof buf) > 0)
+        ;
+    async_remote_t *tasks =
+        __atomic_exchange_n(&async->remote, NULL, __ATOMIC_ACQUIRE);
+    async_remote_t *fifo = NULL;
+    unsigned count = 0;
+    while (tasks) {
+        async_remote_t *task = tasks;
+        tasks = task->next;
+        task->next = fifo;
+        fifo = task;
+        count++;
     }
-    for (;;) {
-        int count;
+    FSTRACE(ASYNC_TAKE_REMOTE_TASKS, async->uid, count);
+    while (fifo) {
+        async_remote_t *task = fifo;
+        fifo = task->next;
+        (void) execute(async, ASYNC_PRIO_NORMAL, task->action);
+        fsfree(task);
+    }
+}
+
+FSTRACE_DECL(ASYNC_OPEN_REMOTE_FAIL, "UID=%64u ERRNO=%e");
+
+static bool open_remote(async_t *async)
+{
+#ifdef __linux__
+    async->remote_readfd = async->remote_writefd =
+        eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (async->remote_readfd < 0) {
+        FSTRACE(ASYNC_OPEN_REMOTE_FAIL, async->uid);
+        return false;
+    }
+#else
+    int fd[2];
+    if (!unixkit_pipe(fd)) {
+        FSTRACE(ASYNC_OPEN_REMOTE_FAIL, async->uid);
+        return false;
+    }
+    async->remote_readfd = fd[0];
+    async->remote_writefd = fd[1];
+    if (async_nonblock(async->remote_writefd) < 0) {
+        FSTRACE(ASYNC_OPEN_REMOTE_FAIL, async->uid);
+        return false;
+    }
+#endif
+    async_io_action take_cb = { async, (async_io_act) take_remote_tasks };
+    if (async_register_2(async, async->remote_readfd, ASYNC_READABLE,
+                         take_cb) < 0) {
+        FSTRACE(ASYNC_OPEN_REMOTE_FAIL, async->uid);
+        return false;
+    }
+    return true;
+}
+
+/* Called after the registrations are gone. Tasks not taken are
+ * discarded. */
+static void close_remote(async_t *async)
+{
+    if (async->remote_readfd >= 0)
+        (void) close(async->remote_readfd);
+    if (async->remote_writefd >= 0 &&
+        async->remote_writefd != async->remote_readfd)
+        (void) close(async->remote_writefd);
+    async_remote_t *tasks = async->remote;
+    while (tasks) {
+        async_remote_t *task = tasks;
+        tasks = task->next;
+        fsfree(task);
+    }
+}
+
+FSTRACE_DECL(ASYNC_WOUND, "UID=%64u SEQNO=%64u OBJ=%p");
+
+void async_wound(async_t *async, void *object)
+{
+    if (async->wounded_count >= async->wounded_capacity) {
+        async->wounded_capacity =
+            async->wounded_capacity ? 2 * async->wounded_capacity : 64;
+        async->wounded =
+            fsrealloc(async->wounded,
+                      async->wounded_capacity * sizeof *async->wounded);
+    }
+    async_wounded_t *wounded = &async->wounded[async->wounded_count++];
+    wounded->object = object;
+    wounded->seqno = fstrace_get_unique_id();
+    FSTRACE(ASYNC_WOUND, async->uid, wounded->seqno, object);
+}
+
+int async_fd(async_t *async)
+{
+    return async->poll_fd;
+}
+
+static char *emit_char(char *p, const char *end, char c)
+{
+    if (p < end)
+        *p++ = c;
+    return p;
+}
+
+static char *emit_address(char *p, const char *end, void *address)
+{
+    char addrbuf[20];
+    snprintf(addrbuf, sizeof addrbuf, "%p", address);
+    const char *q = addrbuf;
+    while (*q)
+        p = emit_char(p, end, *q++);
+    return p;
+}
+
+static void emit_timer_backtrace(async_timer_t *timer)
+{
+    enum { BUF_SIZE = BT_DEPTH * 20 };
+    char buf[BUF_SIZE];
+    const char *end = buf + BUF_SIZE - 1; /* leave room for '\0' */
+    char *p = emit_address(buf, end, timer->stack_trace[0]);
+    int i;
+    for (i = 1; i < BT_DEPTH && timer->stack_trace[i]; i++) {
+        p = emit_char(p, end, '`');
+        p = emit_address(p, end, timer->stack_trace[i]);
+    }
+    *p = '\0';
+    FSTRACE(ASYNC_TIMER_BT, timer->seqno, buf);
+}
+
 #if USE_EPOLL
-        struct epoll_event epoll_event;
-        count = epoll_wait(async->poll_fd, &epoll_event, 1, 0);
-        if (count < 0) {
-            FSTRACE(ASYNC_POLL_FAIL, async->uid);
+static int ns_to_ms(int64_t ns)
+{
+    if (ns < 0)
+        return -1;
+    if (ns > INT_MAX * 1000000LL)
+        return INT_MAX;
+    /* Rounding up is the right thing to do for timeouts to prevent
+     * spurious wakeups. */
+    return (ns + 999999) / 1000000;
+}
+#else
+static struct timespec *ns_to_timespec(int64_t ns, struct timespec *t)
+{
+    if (ns < 0)
+        return NULL;
+    t->tv_sec = ns / 1000000000;
+    t->tv_nsec = ns % 1000000000;
+    return t;
+}
+#endif
+
+typedef struct {
+    int count, cursor;
+#if USE_EPOLL
+    struct epoll_event *epoll_events;
+#else
+    struct kevent *kq_events;
+#endif
+} io_batch_t;
+
+/* The batch buffer is only resized here, right before a wait, so a
+ * policy change never pulls it from under the kernel. */
+static void prepare_io_batch(async_t *async, io_batch_t *batch, int max)
+{
+#if USE_EPOLL
+    size_t size = sizeof *batch->epoll_events;
+#else
+    size_t size = sizeof *batch->kq_events;
+#endif
+    if (async->io_event_capacity < max) {
+        fsfree(async->io_events);
+        async->io_events = fscalloc(max, size);
+        async->io_event_capacity = max;
+    }
+#if USE_EPOLL
+    batch->epoll_events = async->io_events;
+#else
+    batch->kq_events = async->io_events;
+#endif
+    batch->cursor = batch->count = 0;
+}
+
+#if ASYNC_IO_URING
+static unsigned poll_readiness(int32_t revents)
+{
+    unsigned readiness = 0;
+    if (revents & POLLIN)
+        readiness |= ASYNC_READABLE;
+    if (revents & POLLOUT)
+        readiness |= ASYNC_WRITABLE;
+    if (revents & POLLHUP)
+        readiness |= ASYNC_HANGUP;
+    if (revents & POLLERR)
+        readiness |= ASYNC_ERROR;
+    return readiness;
+}
+
+static uint64_t uring_user_data(async_registration_t *registration, int fd)
+{
+    return (uint64_t) registration->generation << 32 | (uint32_t) fd;
+}
+
+/* Return a negative number and set errno if the poll request cannot
+ * be queued. */
+static int uring_arm(async_t *async, int fd,
+                     async_registration_t *registration)
+{
+    uint32_t poll_mask = 0;
+    if (registration->interest & ASYNC_READABLE)
+        poll_mask |= POLLIN;
+    if (registration->interest & ASYNC_WRITABLE)
+        poll_mask |= POLLOUT;
+    if (!poll_mask)
+        return 0;
+    return async_uring_poll_add(async->uring,
+                                uring_user_data(registration, fd), fd,
+                                poll_mask, !registration->level_triggered);
+}
+
+static async_registration_t *get_registration(async_t *async, int fd);
+
+/* Reap a completion. Return false if it carries no I/O event.
+ * Completions of earlier registrations of the same fd are recognized
+ * by the generation in the user data. Level-triggered polls and
+ * terminated multishot polls are rearmed. */
+static bool reap_uring_event(async_t *async, async_event_t **event,
+                             unsigned *readiness)
+{
+    async_uring_completion_t completion;
+    if (!async_uring_reap(async->uring, &completion) ||
+        completion.user_data == ASYNC_URING_IGNORE)
+        return false;
+    int fd = (uint32_t) completion.user_data;
+    async_registration_t *registration = get_registration(async, fd);
+    if (registration == NULL ||
+        registration->generation != completion.user_data >> 32)
+        return false;
+    if (completion.res == -ECANCELED)
+        return false;
+    if (completion.res < 0)
+        *readiness = ASYNC_ERROR;
+    else {
+        *readiness = poll_readiness(completion.res);
+        if (!completion.more && uring_arm(async, fd, registration) < 0)
+            *readiness |= ASYNC_ERROR;
+    }
+    *event = registration->event;
+    return true;
+}
+#endif
+
+#if USE_EPOLL
+FSTRACE_DECL(ASYNC_EPOLL_PWAIT2_UNSUPPORTED, "UID=%64u");
+
+static int epoll_wait_ns(async_t *async, io_batch_t *batch, int max,
+                         int64_t ns)
+{
+#ifdef __NR_epoll_pwait2
+    static bool pwait2_unsupported; /* by the kernel */
+    if (async->high_resolution && ns > 0 && !pwait2_unsupported) {
+        struct __kernel_timespec t = {
+            .tv_sec = ns / 1000000000,
+            .tv_nsec = ns % 1000000000,
+        };
+        int count = syscall(__NR_epoll_pwait2, async->poll_fd,
+                            batch->epoll_events, max, &t, NULL, 0);
+        if (count >= 0 || errno != ENOSYS)
             return count;
+        FSTRACE(ASYNC_EPOLL_PWAIT2_UNSUPPORTED, async->uid);
+        pwait2_unsupported = true;
+    }
+#endif
+    return epoll_wait(async->poll_fd, batch->epoll_events, max, ns_to_ms(ns));
+}
+#endif
+
+static int wait_for_io_batch(async_t *async, int64_t ns, io_batch_t *batch,
+                             int max)
+{
+#if ASYNC_IO_URING
+    if (async->uring) {
+        /* The completions are reaped from the ring; no buffer needed. */
+        batch->cursor = 0;
+        batch->count = async_uring_enter(async->uring, ns);
+        if (batch->count > max)
+            batch->count = max;
+        return batch->count;
+    }
+#endif
+    prepare_io_batch(async, batch, max);
+#if USE_EPOLL
+    batch->count = epoll_wait_ns(async, batch, max, ns);
+#else
+    struct timespec t;
+    batch->count = kevent(async->poll_fd, NULL, 0, batch->kq_events, max,
+                          ns_to_timespec(ns, &t));
+#endif
+    return batch->count;
+}
+
+/* Wait for at most ns nanoseconds (indefinitely if ns is negative) for
+ * at most max I/O events. Return the number of events in the batch or
+ * a negative number in case of an error. */
+static int wait_for_io(async_t *async, int64_t ns, io_batch_t *batch, int max)
+{
+    if (wait_for_io_batch(async, ns, batch, max) < 0 && errno == EINTR &&
+        async->watchdog) {
+        /* The watchdog's SIGURG may arrive after the stalled callback
+         * has returned. Report an empty batch; the caller recomputes
+         * its timeout and waits again. */
+        batch->count = 0;
+    }
+    return batch->count;
+}
+
+/* Return the next I/O event of the batch skipping the sentinel event.
+ * Return false when the batch has been exhausted. */
+static bool next_io_event(async_t *async, io_batch_t *batch,
+                          async_event_t **event, unsigned *readiness)
+{
+    while (batch->cursor < batch->count) {
+        int i = batch->cursor++;
+#if ASYNC_IO_URING
+        if (async->uring) {
+            if (reap_uring_event(async, event, readiness) &&
+                *event != ASYNC_SENTINEL_EVENT)
+                return true;
+            continue;
         }
-        if (count == 0) {
-            FSTRACE(ASYNC_POLL_SPURIOUS, async->uid);
-            return 0;
-        }
-        async_event_t *event = epoll_event.data.ptr;
+#endif
+#if USE_EPOLL
+        *event = batch->epoll_events[i].data.ptr;
+        *readiness = epoll_readiness(batch->epoll_events[i].events);
 #else
-        struct kevent kq_event;
-        struct timespec immediate = { 0, 0 };
-        count = kevent(async->poll_fd, NULL, 0, &kq_event, 1, &immediate);
+        *event = batch->kq_events[i].udata;
+        *readiness = kevent_readiness(&batch->kq_events[i]);
+#endif
+        if (*event != ASYNC_SENTINEL_EVENT)
+            return true;
+    }
+    return false;
+}
+
+static void profile_clear(async_t *async)
+{
+    fsfree(async->profile);
+    async->profile = NULL;
+    async->profile_capacity = async->profile_size = 0;
+}
+
+FSTRACE_DECL(ASYNC_SET_PROFILING, "UID=%64u PERIOD=%u");
+
+void async_set_profiling(async_t *async, unsigned period)
+{
+    FSTRACE(ASYNC_SET_PROFILING, async->uid, period);
+    profile_clear(async);
+    async->profile_period = async->profile_countdown = period;
+}
+
+/* The profile is an open-addressing hash table keyed by the act
+ * pointer. */
+static async_profile_entry_t *profile_slot(async_profile_entry_t *profile,
+                                           size_t capacity, void *act)
+{
+    size_t i = ((uintptr_t) act >> 4) * 0x9e3779b97f4a7c15ULL;
+    for (;; i++) {
+        async_profile_entry_t *entry = &profile[i & (capacity - 1)];
+        if (entry->act == act || !entry->act)
+            return entry;
+    }
+}
+
+static async_profile_entry_t *profile_entry(async_t *async, void *act)
+{
+    if (2 * (async->profile_size + 1) > async->profile_capacity) {
+        size_t capacity = async->profile_capacity ?
+            2 * async->profile_capacity : 64;
+        async_profile_entry_t *profile = fscalloc(capacity, sizeof *profile);
+        size_t i;
+        for (i = 0; i < async->profile_capacity; i++)
+            if (async->profile[i].act)
+                *profile_slot(profile, capacity, async->profile[i].act) =
+                    async->profile[i];
+        fsfree(async->profile);
+        async->profile = profile;
+        async->profile_capacity = capacity;
+    }
+    async_profile_entry_t *entry =
+        profile_slot(async->profile, async->profile_capacity, act);
+    if (!entry->act) {
+        entry->act = act;
+        async->profile_size++;
+    }
+    return entry;
+}
+
+/* Events are dispatched through event_perf(); attribute the callback
+ * to the action of the event instead. */
+static void *dispatched_act(action_1 action)
+{
+    if (action.act == (act_1) once_perf)
+        return ((async_once_t *) action.obj)->action.act;
+    if (action.act != (act_1) event_perf)
+        return action.act;
+    async_event_t *event = action.obj;
+    if (event->state != ASYNC_EVENT_TRIGGERED)
+        return action.act;
+    if (event->io_action.act)
+        return event->io_action.act;
+    return event->action.act;
+}
+
+static void perform_profiled(async_t *async, action_1 action)
+{
+    async->profile_countdown = async->profile_period;
+    void *act = dispatched_act(action);
+    uint64_t t0 = read_clock(async);
+    action_1_perf(action);
+    uint64_t duration = read_clock(async) - t0;
+    async_profile_entry_t *entry = profile_entry(async, act);
+    entry->count++;
+    entry->total_ns += duration;
+    if (duration > entry->max_ns)
+        entry->max_ns = duration;
+}
+
+/* Perform a timer action, timing every profile_period-th one. */
+static void perform(async_t *async, action_1 action)
+{
+    if (async->watchdog)
+        async_watchdog_enter(async->watchdog, dispatched_act(action));
+    if (async->profile_period && !--async->profile_countdown)
+        perform_profiled(async, action);
+    else
+        action_1_perf(action);
+    if (async->watchdog)
+        async_watchdog_leave(async->watchdog);
+}
+
+int async_start_watchdog(async_t *async, uint64_t threshold,
+                         async_stall_action sink)
+{
+    if (async->watchdog)
+        async_stop_watchdog(async);
+    async->watchdog = async_watchdog_create(async->uid, threshold, sink);
+    return async->watchdog ? 0 : -1;
+}
+
+void async_stop_watchdog(async_t *async)
+{
+    if (async->watchdog) {
+        async_watchdog_destroy(async->watchdog);
+        async->watchdog = NULL;
+    }
+}
+
+static int profile_cmp(const void *a, const void *b)
+{
+    const async_profile_entry_t *e1 = a, *e2 = b;
+    return (e1->total_ns < e2->total_ns) - (e1->total_ns > e2->total_ns);
+}
+
+void async_dump_profile(async_t *async, FILE *out)
+{
+    async_profile_entry_t *entries =
+        fscalloc(async->profile_size + 1, sizeof *entries);
+    size_t i, n = 0;
+    for (i = 0; i < async->profile_capacity; i++)
+        if (async->profile[i].act)
+            entries[n++] = async->profile[i];
+    qsort(entries, n, sizeof *entries, profile_cmp);
+#ifdef HAVE_EXECINFO
+    void **acts = fscalloc(n + 1, sizeof *acts);
+    for (i = 0; i < n; i++)
+        acts[i] = entries[i].act;
+    char **symbols = backtrace_symbols(acts, n);
+    fsfree(acts);
+#endif
+    fprintf(out, "%-12s %-14s %-12s %s\n", "count", "total-ns", "max-ns",
+            "act");
+    for (i = 0; i < n; i++) {
+        fprintf(out, "%-12llu %-14llu %-12llu %p",
+                (unsigned long long) entries[i].count,
+                (unsigned long long) entries[i].total_ns,
+                (unsigned long long) entries[i].max_ns, entries[i].act);
+#ifdef HAVE_EXECINFO
+        if (symbols)
+            fprintf(out, " %s", symbols[i]);
+#endif
+        fprintf(out, "\n");
+    }
+#ifdef HAVE_EXECINFO
+    free(symbols);
+#endif
+    fsfree(entries);
+}
+
+static async_hook_t *add_hook(async_t *async, async_hook_list_t *list,
+                              action_1 action)
+{
+    async_hook_t *hook = fsalloc(sizeof *hook);
+    hook->list = list;
+    hook->prev = list->last;
+    hook->next = NULL;
+    hook->seqno = fstrace_get_unique_id();
+    hook->action = action;
+    if (list->last)
+        list->last->next = hook;
+    else
+        list->first = hook;
+    list->last = hook;
+    return hook;
+}
+
+FSTRACE_DECL(ASYNC_ADD_PREPARE_HOOK, "UID=%64u PTR=%p ASYNC=%64u OBJ=%p ACT=%p");
+
+async_hook_t *async_add_prepare_hook(async_t *async, action_1 action)
+{
+    async_hook_t *hook = add_hook(async, &async->prepare_hooks, action);
+    FSTRACE(ASYNC_ADD_PREPARE_HOOK, hook->seqno, hook, async->uid, action.obj,
+            action.act);
+    return hook;
+}
+
+FSTRACE_DECL(ASYNC_ADD_CHECK_HOOK, "UID=%64u PTR=%p ASYNC=%64u OBJ=%p ACT=%p");
+
+async_hook_t *async_add_check_hook(async_t *async, action_1 action)
+{
+    async_hook_t *hook = add_hook(async, &async->check_hooks, action);
+    FSTRACE(ASYNC_ADD_CHECK_HOOK, hook->seqno, hook, async->uid, action.obj,
+            action.act);
+    return hook;
+}
+
+FSTRACE_DECL(ASYNC_REMOVE_HOOK, "UID=%64u");
+
+void async_remove_hook(async_t *async, async_hook_t *hook)
+{
+    FSTRACE(ASYNC_REMOVE_HOOK, hook->seqno);
+    if (async->hook_cursor == hook)
+        async->hook_cursor = hook->next;
+    async_hook_list_t *list = hook->list;
+    if (hook->prev)
+        hook->prev->next = hook->next;
+    else
+        list->first = hook->next;
+    if (hook->next)
+        hook->next->prev = hook->prev;
+    else
+        list->last = hook->prev;
+    fsfree(hook);
+}
+
+/* Call the hooks that exist at the outset. The cursor is kept in the
+ * async object so a hook may remove any hook, itself included. New
+ * hooks are appended with a higher seqno and left for the next time. */
+static void run_hooks(async_t *async, async_hook_list_t *list)
+{
+    if (!list->first)
+        return;
+    uint64_t limit = list->last->seqno;
+    async->hook_cursor = list->first;
+    while (async->hook_cursor && async->hook_cursor->seqno <= limit) {
+        async_hook_t *hook = async->hook_cursor;
+        async->hook_cursor = hook->next;
+        perform(async, hook->action);
+    }
+    async->hook_cursor = NULL;
+}
+
+/* Run the prepare hooks before the loop waits for ns nanoseconds (or
+ * indefinitely if ns is negative). Return the wait shortened according
+ * to the tasks and timers the hooks may have scheduled. */
+static int64_t prepare_to_wait(async_t *async, int64_t ns)
+{
+    if (!async->prepare_hooks.first)
+        return ns;
+    run_hooks(async, &async->prepare_hooks);
+    if (async->quit)
+        return 0;
+    uint64_t now = async->recent;
+    uint64_t expires = next_expiry(async, earliest_timer(async));
+    if (expires == (uint64_t) -1)
+        return ns;
+    if (expires <= now)
+        return 0;
+    if (ns < 0 || expires - now < ns)
+        return expires - now;
+    return ns;
+}
+
+FSTRACE_DECL(ASYNC_POLL_NO_TIMERS, "UID=%64u");
+FSTRACE_DECL(ASYNC_POLL_TIMEOUT, "UID=%64u OBJ=%p ACT=%p");
+FSTRACE_DECL(ASYNC_POLL_NEXT_TIMER, "UID=%64u EXPIRES=%64u");
+FSTRACE_DECL(ASYNC_POLL_FAIL, "UID=%64u ERRNO=%e");
+FSTRACE_DECL(ASYNC_POLL_SPURIOUS, "UID=%64u");
+FSTRACE_DECL(ASYNC_POLL_CALL_BACK, "UID=%64u EVENT=%64u");
+FSTRACE_DECL(ASYNC_POLL_SKIP_SENTINEL, "UID=%64u");
+
+static void poll_timer(async_t *async, async_timer_t *timer, uint64_t now)
+{
+    action_1 action = timer->action;
+    FSTRACE(ASYNC_POLL_TIMEOUT, timer->seqno, timer->action.obj,
+            timer->action.act);
+    if (FSTRACE_ENABLED(ASYNC_TIMER_BT) && timer->stack_trace)
+        emit_timer_backtrace(timer);
+    account_dispatch(async, timer, now);
+    expire_timer(async, timer, now);
+    perform(async, action);
+}
+
+int async_poll(async_t *async, uint64_t *pnext_timeout)
+{
+    if (!async_set_up_wakeup(async))
+        return -1;
+    reclaim_wounded_objects(async);
+    uint64_t now = async_now(async);
+    turn_wheel(async, now);
+    async_timer_t *timer = earliest_timer(async);
+    if ((timer == NULL || timer->expires > now) &&
+        async->prepare_hooks.first) {
+        run_hooks(async, &async->prepare_hooks);
+        turn_wheel(async, now);
+        timer = earliest_timer(async);
+    }
+    if (timer != NULL && timer->expires <= now) {
+        poll_timer(async, timer, now);
+        *pnext_timeout = 0;
+        return 0;
+    }
+    uint64_t expires = next_expiry(async, timer);
+    if (expires == (uint64_t) -1) {
+        *pnext_timeout = (uint64_t) -1;
+        async_cancel_wakeup(async);   /* not absolutely necessary */
+        FSTRACE(ASYNC_POLL_NO_TIMERS, async->uid);
+    } else {
+        FSTRACE(ASYNC_POLL_NEXT_TIMER, async->uid, expires);
+        *pnext_timeout = expires;
+    }
+    for (;;) {
+        io_batch_t batch;
+        int count = wait_for_io(async, 0, &batch, 1);
         if (count < 0) {
             FSTRACE(ASYNC_POLL_FAIL, async->uid);
             return count;
@@ -491,12 +1751,13 @@ int async_poll(async_t *async, uint64_t *pnext_timeout)
             FSTRACE(ASYNC_POLL_SPURIOUS, async->uid);
             return 0;
         }
-        async_event_t *event = kq_event.udata;
-#endif
         async_arm_wakeup(async);
-        if (event != ASYNC_SENTINEL_EVENT) {
+        run_hooks(async, &async->check_hooks);
+        async_event_t *event;
+        unsigned readiness;
+        if (next_io_event(async, &batch, &event, &readiness)) {
             FSTRACE(ASYNC_POLL_CALL_BACK, async->uid, event->uid);
-            async_event_trigger(event);
+            io_event_trigger(event, readiness);
             *pnext_timeout = 0;
             return 0;
         }
@@ -504,6 +1765,85 @@ int async_poll(async_t *async, uint64_t *pnext_timeout)
     }
 }
 
+FSTRACE_DECL(ASYNC_POLL_N, "UID=%64u MAX=%u BUDGET=%64u");
+FSTRACE_DECL(ASYNC_POLL_N_FAIL, "UID=%64u ERRNO=%e");
+FSTRACE_DECL(ASYNC_POLL_N_CALL_BACK, "UID=%64u EVENT=%64u");
+FSTRACE_DECL(ASYNC_POLL_N_DONE, "UID=%64u COUNT=%u NEXT=%64u");
+
+/* Harvest at most max I/O events without blocking and queue their
+ * callbacks. Return the number of events harvested (including the
+ * sentinel event) or a negative number in case of an error. */
+static int poll_io_batch(async_t *async, int max)
+{
+    io_batch_t batch;
+    int count = wait_for_io(async, 0, &batch, max);
+    if (count <= 0)
+        return count;
+    async_arm_wakeup(async);
+    run_hooks(async, &async->check_hooks);
+    async_event_t *event;
+    unsigned readiness;
+    while (next_io_event(async, &batch, &event, &readiness)) {
+        FSTRACE(ASYNC_POLL_N_CALL_BACK, async->uid, event->uid);
+        io_event_trigger(event, readiness);
+    }
+    return count;
+}
+
+int async_poll_n(async_t *async, unsigned max, uint64_t budget,
+                 uint64_t *pnext_timeout)
+{
+    FSTRACE(ASYNC_POLL_N, async->uid, max, budget);
+    if (!async_set_up_wakeup(async))
+        return -1;
+    reclaim_wounded_objects(async);
+    uint64_t now = async_now(async);
+    uint64_t deadline =
+        budget < (uint64_t) -1 - now ? now + budget : (uint64_t) -1;
+    unsigned count = 0;
+    bool io_drained = false;
+    async_timer_t *timer;
+    for (;;) {
+        turn_wheel(async, now);
+        timer = earliest_timer(async);
+        if (timer != NULL && timer->expires <= now) {
+            if (count >= max || (count > 0 && now >= deadline))
+                break;
+            poll_timer(async, timer, now);
+            count++;
+            now = async_now(async);
+            continue;
+        }
+        if (io_drained || count >= max || (count > 0 && now >= deadline))
+            break;
+        if (async->prepare_hooks.first) {
+            run_hooks(async, &async->prepare_hooks);
+            turn_wheel(async, now);
+            timer = earliest_timer(async);
+            if (timer != NULL && timer->expires <= now)
+                continue;
+        }
+        int batch_max = async->io_burst;
+        if (max - count < batch_max)
+            batch_max = max - count;
+        int events = poll_io_batch(async, batch_max);
+        if (events < 0) {
+            FSTRACE(ASYNC_POLL_N_FAIL, async->uid);
+            return -1;
+        }
+        io_drained = events < batch_max;
+    }
+    if (timer != NULL && timer->expires <= now)
+        *pnext_timeout = 0;
+    else {
+        *pnext_timeout = next_expiry(async, timer);
+        if (*pnext_timeout == (uint64_t) -1)
+            async_cancel_wakeup(async);
+    }
+    FSTRACE(ASYNC_POLL_N_DONE, async->uid, count, *pnext_timeout);
+    return count;
+}
+
 #if !PIPE_WAKEUP
 int async_poll_2(async_t *async)
 {
@@ -560,56 +1900,99 @@ FSTRACE_DECL(ASYNC_LOOP_NO_TIMERS, "UID=%64u");
 FSTRACE_DECL(ASYNC_LOOP_NEXT_TIMER, "UID=%64u EXPIRES=%64u");
 FSTRACE_DECL(ASYNC_LOOP_TIMEOUT, "UID=%64u OBJ=%p ACT=%p");
 
-/* Return nanoseconds till the next timer expiry or a negative number. */
+/* Return nanoseconds till the next timer expiry or a negative number.
+ *
+ * The clock is read once up front; the callbacks are dispatched
+ * according to the cached time, which is refreshed only before
+ * deciding there is nothing more to do. */
 static int64_t take_immediate_action(async_t *async)
 {
-    enum {
-        MAX_IO_STARVATION = 20,
-    };
-    int i;
-    for (i = 0; !async->quit && i < MAX_IO_STARVATION; i++) {
+    account_iteration(async, async_now(async));
+    reclaim_wounded_objects(async);
+    unsigned budget = async->policy.callback_budget;
+    bool fresh = true;
+    unsigned i;
+    for (i = 0; !async->quit && i < budget; i++) {
+        uint64_t now = async->recent;
+        turn_wheel(async, now);
         async_timer_t *timer = earliest_timer(async);
-        if (timer == NULL) {
-            FSTRACE(ASYNC_LOOP_NO_TIMERS, async->uid);
-            return -1;
+        if ((timer == NULL || timer->expires > now) && !fresh) {
+            now = async_now(async);
+            turn_wheel(async, now);
+            timer = earliest_timer(async);
         }
-        int64_t ns = ns_remaining(async, timer);
-        if (ns > 0) {
-            FSTRACE(ASYNC_LOOP_NEXT_TIMER, async->uid, timer->expires);
-            return ns;
+        if (timer == NULL || timer->expires > now) {
+            uint64_t expires = next_expiry(async, timer);
+            histogram_add(&async->stats.iteration_callbacks, i);
+            if (expires == (uint64_t) -1) {
+                FSTRACE(ASYNC_LOOP_NO_TIMERS, async->uid);
+                return -1;
+            }
+            FSTRACE(ASYNC_LOOP_NEXT_TIMER, async->uid, expires);
+            return expires - now;
         }
         action_1 action = timer->action;
         FSTRACE(ASYNC_LOOP_TIMEOUT, timer->seqno, timer->action.obj,
                 timer->action.act);
         if (FSTRACE_ENABLED(ASYNC_TIMER_BT) && timer->stack_trace)
             emit_timer_backtrace(timer);
-        timer_cancel(async, timer);
-        action_1_perf(action);
+        account_dispatch(async, timer, now);
+        expire_timer(async, timer, now);
+        fresh = false;
+        perform(async, action);
     }
+    histogram_add(&async->stats.iteration_callbacks, i);
+    if (i >= budget)
+        stats_add(&async->stats.starved_iterations, 1);
     return 0;
 }
 
-#if USE_EPOLL
-static int ns_to_ms(int64_t ns)
+/* Called before the loop waits for I/O for ns nanoseconds. The clock
+ * has been read right before a nonzero wait. */
+static void account_wait(async_t *async, int64_t ns)
 {
-    if (ns < 0)
-        return -1;
-    if (ns > INT_MAX * 1000000LL)
-        return INT_MAX;
-    /* Rounding up is the right thing to do for timeouts to prevent
-     * spurious wakeups. */
-    return (ns + 999999) / 1000000;
+    if (ns != 0)
+        async->wait_started = async->recent;
 }
-#else
-static struct timespec *ns_to_timespec(int64_t ns, struct timespec *t)
+
+enum {
+    SHRINK_AFTER_SMALL_BATCHES = 16,
+};
+
+/* Double the burst after a full batch. Halve it (but not below the
+ * configured burst) after a run of batches that would have fit in a
+ * quarter of it. */
+static void adapt_io_burst(async_t *async, int count)
 {
-    if (ns < 0)
-        return NULL;
-    t->tv_sec = ns / 1000000000;
-    t->tv_nsec = ns % 1000000000;
-    return t;
+    if (count >= async->io_burst) {
+        async->small_batches = 0;
+        async->io_burst *= 2;
+        if (async->io_burst > async->policy.max_io_burst)
+            async->io_burst = async->policy.max_io_burst;
+        return;
+    }
+    if (count > async->io_burst / 4 ||
+        async->io_burst <= async->policy.io_burst) {
+        async->small_batches = 0;
+        return;
+    }
+    if (++async->small_batches < SHRINK_AFTER_SMALL_BATCHES)
+        return;
+    async->small_batches = 0;
+    async->io_burst /= 2;
+    if (async->io_burst < async->policy.io_burst)
+        async->io_burst = async->policy.io_burst;
+}
+
+static void account_io_batch(async_t *async, int count)
+{
+    stats_add(&async->stats.io_waits, 1);
+    histogram_add(&async->stats.io_batch, count);
+    if (count >= async->io_burst)
+        stats_add(&async->stats.full_io_batches, 1);
+    if (async->policy.adaptive)
+        adapt_io_burst(async, count);
 }
-#endif
 
 FSTRACE_DECL(ASYNC_LOOP, "UID=%64u");
 FSTRACE_DECL(ASYNC_LOOP_QUIT, "UID=%64u");
@@ -620,42 +2003,30 @@ FSTRACE_DECL(ASYNC_LOOP_EXECUTE, "UID=%64u EVENT=%64u");
 int async_loop(async_t *async)
 {
     FSTRACE(ASYNC_LOOP, async->uid);
-    enum {
-        MAX_IO_BURST = 20,
-    };
     async->quit = false;
+    async->iteration_started = 0;
     for (;;) {
         int64_t ns = take_immediate_action(async);
         if (async->quit) {
             FSTRACE(ASYNC_LOOP_QUIT, async->uid);
             return 0;
         }
+        ns = prepare_to_wait(async, ns);
         FSTRACE(ASYNC_LOOP_WAIT, async->uid, ns);
-#if USE_EPOLL
-        struct epoll_event epoll_events[MAX_IO_BURST];
-        int count = epoll_wait(async->poll_fd, epoll_events, MAX_IO_BURST,
-                               ns_to_ms(ns));
-#else
-        struct kevent kq_events[MAX_IO_BURST];
-        struct timespec t;
-        int count = kevent(async->poll_fd, NULL, 0, kq_events, MAX_IO_BURST,
-                           ns_to_timespec(ns, &t));
-#endif
+        account_wait(async, ns);
+        io_batch_t batch;
+        int count = wait_for_io(async, ns, &batch, async->io_burst);
         if (count < 0) {
             FSTRACE(ASYNC_LOOP_FAIL, async->uid);
             return -1;
         }
-        int i;
-        for (i = 0; i < count; i++) {
-#if USE_EPOLL
-            async_event_t *event = epoll_events[i].data.ptr;
-#else
-            async_event_t *event = kq_events[i].udata;
-#endif
-            if (event != ASYNC_SENTINEL_EVENT) {
-                async_event_trigger(event);
-                FSTRACE(ASYNC_LOOP_EXECUTE, async->uid, event->uid);
-            }
+        account_io_batch(async, count);
+        run_hooks(async, &async->check_hooks);
+        async_event_t *event;
+        unsigned readiness;
+        while (next_io_event(async, &batch, &event, &readiness)) {
+            io_event_trigger(event, readiness);
+            FSTRACE(ASYNC_LOOP_EXECUTE, async->uid, event->uid);
         }
     }
 }
@@ -668,6 +2039,7 @@ static bool prepare_protected_loop(async_t *async)
     if (!async_set_up_wakeup(async))
         return false;
     async->quit = false;
+    async->iteration_started = 0;
     return true;
 }
 
@@ -676,65 +2048,149 @@ FSTRACE_DECL(ASYNC_LOOP_PROTECTED_FAIL, "UID=%64u ERRNO=%e");
 FSTRACE_DECL(ASYNC_LOOP_PROTECTED_EXECUTE, "UID=%64u EVENT=%64u");
 FSTRACE_DECL(ASYNC_LOOP_PROTECTED_QUIT, "UID=%64u");
 
-int async_loop_protected(async_t *async, void (*lock)(void *),
-                         void (*unlock)(void *), void *lock_data)
+enum {
+    CONTENDED_LOCK_NS = 1000,
+};
+
+/* Release the lock around a wait for I/O. The lock hold that ends and
+ * the time it takes to get the lock back are accounted for. Return the
+ * wait's result; the time the lock was regained is stored in
+ * *pheld_since. */
+static int wait_unlocked(async_t *async, int64_t ns, io_batch_t *batch,
+                         void (*lock)(void *), void (*unlock)(void *),
+                         void *lock_data, uint64_t *pheld_since)
+{
+    async_stats_t *stats = &async->stats;
+    histogram_add(&stats->lock_hold, read_clock(async) - *pheld_since);
+    stats_add(&stats->lock_releases, 1);
+    unlock(lock_data);
+    int count = wait_for_io(async, ns, batch, async->io_burst);
+    int err = errno;
+    uint64_t t0 = read_clock(async);
+    lock(lock_data);
+    *pheld_since = read_clock(async);
+    uint64_t waited = *pheld_since - t0;
+    histogram_add(&stats->lock_wait, waited);
+    if (waited >= CONTENDED_LOCK_NS)
+        stats_add(&stats->contended_locks, 1);
+    errno = err;
+    return count;
+}
+
+int async_loop_protected_2(async_t *async, void (*lock)(void *),
+                           void (*unlock)(void *), void *lock_data,
+                           uint64_t max_hold)
 {
-    enum {
-        MAX_IO_BURST = 20,
-    };
     if (!prepare_protected_loop(async))
         return -1;
+    uint64_t held_since = async_now(async);
     for (;;) {
         int64_t ns = take_immediate_action(async);
         if (async->quit) {
             FSTRACE(ASYNC_LOOP_PROTECTED_QUIT, async->uid);
             return 0;
         }
+        ns = prepare_to_wait(async, ns);
         FSTRACE(ASYNC_LOOP_PROTECTED_WAIT, async->uid, ns);
-        unlock(lock_data);
-#if USE_EPOLL
-        struct epoll_event epoll_events[MAX_IO_BURST];
-        int count = epoll_wait(async->poll_fd, epoll_events, MAX_IO_BURST,
-                               ns_to_ms(ns));
-#else
-        struct kevent kq_events[MAX_IO_BURST];
-        struct timespec t;
-        int count = kevent(async->poll_fd, NULL, 0, kq_events, MAX_IO_BURST,
-                           ns_to_timespec(ns, &t));
-#endif
-        int err = errno;
-        lock(lock_data);
+        account_wait(async, ns);
+        io_batch_t batch;
+        int count;
+        /* The callbacks of this iteration have run since the clock was
+         * last read. */
+        if (ns == 0 && read_clock(async) - held_since < max_hold) {
+            stats_add(&async->stats.unlocks_skipped, 1);
+            count = wait_for_io(async, 0, &batch, async->io_burst);
+        } else
+            count = wait_unlocked(async, ns, &batch, lock, unlock, lock_data,
+                                  &held_since);
         if (count < 0) {
-            errno = err;
             FSTRACE(ASYNC_LOOP_PROTECTED_FAIL, async->uid);
             return -1;
         }
+        account_io_batch(async, count);
         async_arm_wakeup(async);
-        int i;
-        for (i = 0; i < count; i++) {
-#if USE_EPOLL
-            async_event_t *event = epoll_events[i].data.ptr;
-#else
-            async_event_t *event = kq_events[i].udata;
-#endif
-            if (event != ASYNC_SENTINEL_EVENT) {
-                async_event_trigger(event);
-                FSTRACE(ASYNC_LOOP_PROTECTED_EXECUTE, async->uid, event->uid);
-            }
+        run_hooks(async, &async->check_hooks);
+        async_event_t *event;
+        unsigned readiness;
+        while (next_io_event(async, &batch, &event, &readiness)) {
+            io_event_trigger(event, readiness);
+            FSTRACE(ASYNC_LOOP_PROTECTED_EXECUTE, async->uid, event->uid);
         }
     }
 }
 
+int async_loop_protected(async_t *async, void (*lock)(void *),
+                         void (*unlock)(void *), void *lock_data)
+{
+    return async_loop_protected_2(async, lock, unlock, lock_data, 0);
+}
+
 FSTRACE_DECL(ASYNC_REGISTER_FAIL, "UID=%64u FD=%d EVENT=%p ERRNO=%e");
 FSTRACE_DECL(ASYNC_REGISTER, "UID=%64u FD=%d EVENT=%p");
 
-int async_register_event(async_t *async, int fd, async_event_t *event)
+static async_registration_t *get_registration(async_t *async, int fd)
 {
-    if (async_nonblock(fd) < 0)
-        return -1;
+    if (fd < 0 || fd >= async->registration_capacity ||
+        !async->registrations[fd].registered)
+        return NULL;
+    return &async->registrations[fd];
+}
+
+static async_registration_t *add_registration(async_t *async, int fd,
+                                              async_event_t *event,
+                                              unsigned interest,
+                                              bool level_triggered)
+{
+    if (fd >= async->registration_capacity) {
+        size_t capacity = async->registration_capacity;
+        size_t new_capacity = capacity ? capacity : 64;
+        while (new_capacity <= fd)
+            new_capacity *= 2;
+        async->registrations =
+            fsrealloc(async->registrations,
+                      new_capacity * sizeof *async->registrations);
+        memset(async->registrations + capacity, 0,
+               (new_capacity - capacity) * sizeof *async->registrations);
+        async->registration_capacity = new_capacity;
+    }
+    async_registration_t *registration = &async->registrations[fd];
+    registration->registered = true;
+    registration->event = event;
+    registration->interest = interest;
+    registration->level_triggered = level_triggered;
+    registration->generation++;
+    return registration;
+}
+
+/* The fd must be nonblocking already. The event is disposed of in
+ * case of an error. */
+static int register_event(async_t *async, int fd, async_event_t *event,
+                          unsigned interest)
+{
+#if ASYNC_IO_URING
+    if (async->uring) {
+        async_registration_t *registration =
+            add_registration(async, fd, event, interest, false);
+        if (uring_arm(async, fd, registration) < 0) {
+            FSTRACE(ASYNC_REGISTER_FAIL, async->uid, fd, event);
+            registration->registered = false;
+            registration->event = NULL;
+            if (event != ASYNC_SENTINEL_EVENT)
+                destroy_async_event(event);
+            return -1;
+        }
+        async_wake_up(async);
+        FSTRACE(ASYNC_REGISTER, async->uid, fd, event);
+        return 0;
+    }
+#endif
 #if USE_EPOLL
     struct epoll_event epoll_event;
-    epoll_event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    epoll_event.events = EPOLLET;
+    if (interest & ASYNC_READABLE)
+        epoll_event.events |= EPOLLIN;
+    if (interest & ASYNC_WRITABLE)
+        epoll_event.events |= EPOLLOUT;
     epoll_event.data.ptr = event;
     if (epoll_ctl(async->poll_fd, EPOLL_CTL_ADD, fd, &epoll_event) < 0) {
         FSTRACE(ASYNC_REGISTER_FAIL, async->uid, fd, event);
@@ -745,9 +2201,13 @@ int async_register_event(async_t *async, int fd, async_event_t *event)
     }
 #else
     struct kevent changes[2];
-    EV_SET(&changes[0], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, event);
-    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, event);
-    if (kevent(async->poll_fd, changes, 2, NULL, 0, NULL) < 0) {
+    int n = 0;
+    if (interest & ASYNC_READABLE)
+        EV_SET(&changes[n++], fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, event);
+    if (interest & ASYNC_WRITABLE)
+        EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0,
+               event);
+    if (kevent(async->poll_fd, changes, n, NULL, 0, NULL) < 0) {
         FSTRACE(ASYNC_REGISTER_FAIL, async->uid, fd, event);
         if (event != ASYNC_SENTINEL_EVENT) {
             destroy_async_event(event);
@@ -755,12 +2215,45 @@ int async_register_event(async_t *async, int fd, async_event_t *event)
         return -1;
     }
 #endif
-    (void) avl_tree_put(async->registrations, (void *) (intptr_t) fd, event);
+    add_registration(async, fd, event, interest, false);
     async_wake_up(async);
     FSTRACE(ASYNC_REGISTER, async->uid, fd, event);
     return 0;
 }
 
+int async_register_event(async_t *async, int fd, async_event_t *event)
+{
+    if (async_nonblock(fd) < 0)
+        return -1;
+    return register_event(async, fd, event, ASYNC_READABLE | ASYNC_WRITABLE);
+}
+
+FSTRACE_DECL(ASYNC_REGISTER_2_FAIL,
+             "UID=%64u FD=%d INTEREST=0x%x OBJ=%p ACT=%p ERRNO=%e");
+FSTRACE_DECL(ASYNC_REGISTER_2,
+             "UID=%64u FD=%d INTEREST=0x%x OBJ=%p ACT=%p");
+
+int async_register_2(async_t *async, int fd, unsigned interest,
+                     async_io_action action)
+{
+    if (async_nonblock(fd) < 0) {
+        FSTRACE(ASYNC_REGISTER_2_FAIL, async->uid, fd, interest, action.obj,
+                action.act);
+        return -1;
+    }
+    async_event_t *event = make_async_event(async, NULL_ACTION_1);
+    event->io_action = action;
+    if (register_event(async, fd, event, interest) < 0) {
+        /* register_event() has disposed of the event */
+        FSTRACE(ASYNC_REGISTER_2_FAIL, async->uid, fd, interest, action.obj,
+                action.act);
+        return -1;
+    }
+    FSTRACE(ASYNC_REGISTER_2, async->uid, fd, interest, action.obj,
+            action.act);
+    return 0;
+}
+
 FSTRACE_DECL(ASYNC_REGISTER_NONBLOCK_FAIL, "UID=%64u FD=%d OBJ=%p ACT=%p ERRNO=%e");
 
 int async_register(async_t *async, int fd, action_1 action)
@@ -781,6 +2274,24 @@ FSTRACE_DECL(ASYNC_REGISTER_OLD_SCHOOL, "UID=%64u FD=%d OBJ=%p ACT=%p");
 int async_register_old_school(async_t *async, int fd, action_1 action)
 {
     async_event_t *event = make_async_event(async, action);
+#if ASYNC_IO_URING
+    if (async->uring) {
+        async_registration_t *registration =
+            add_registration(async, fd, event, ASYNC_READABLE, true);
+        if (uring_arm(async, fd, registration) < 0) {
+            FSTRACE(ASYNC_REGISTER_OLD_SCHOOL_FAIL, async->uid, fd,
+                    action.obj, action.act);
+            registration->registered = false;
+            registration->event = NULL;
+            destroy_async_event(event);
+            return -1;
+        }
+        async_wake_up(async);
+        FSTRACE(ASYNC_REGISTER_OLD_SCHOOL, async->uid, fd, action.obj,
+                action.act);
+        return 0;
+    }
+#endif
 #if USE_EPOLL
     struct epoll_event epoll_event;
     epoll_event.events = EPOLLIN;
@@ -802,7 +2313,7 @@ int async_register_old_school(async_t *async, int fd, action_1 action)
         return -1;
     }
 #endif
-    (void) avl_tree_put(async->registrations, (void *) (intptr_t) fd, event);
+    add_registration(async, fd, event, ASYNC_READABLE, true);
     async_wake_up(async);
     FSTRACE(ASYNC_REGISTER_OLD_SCHOOL, async->uid, fd, action.obj, action.act);
     return 0;
@@ -814,13 +2325,37 @@ FSTRACE_DECL(ASYNC_MODIFY_OLD_SCHOOL, "UID=%64u FD=%d RD=%d WR=%d");
 
 int async_modify_old_school(async_t *async, int fd, int readable, int writable)
 {
-    avl_elem_t *elem =
-        avl_tree_get(async->registrations, (void *) (intptr_t) fd);
-    if (elem == NULL) {
+    async_registration_t *registration = get_registration(async, fd);
+    if (registration == NULL) {
         errno = EBADF;
         return -1;
     }
-    async_event_t *event = (async_event_t *) avl_elem_get_value(elem);
+    async_event_t *event = registration->event;
+    unsigned interest = 0;
+    if (readable)
+        interest |= ASYNC_READABLE;
+    if (writable)
+        interest |= ASYNC_WRITABLE;
+#if ASYNC_IO_URING
+    if (async->uring) {
+        if (async_uring_poll_remove(async->uring,
+                                    uring_user_data(registration, fd)) < 0) {
+            FSTRACE(ASYNC_MODIFY_OLD_SCHOOL_FAIL, async->uid, fd, readable,
+                    writable);
+            return -1;
+        }
+        registration->generation++;
+        registration->interest = interest;
+        if (uring_arm(async, fd, registration) < 0) {
+            FSTRACE(ASYNC_MODIFY_OLD_SCHOOL_FAIL, async->uid, fd, readable,
+                    writable);
+            return -1;
+        }
+        async_wake_up(async);
+        FSTRACE(ASYNC_MODIFY_OLD_SCHOOL, async->uid, fd, readable, writable);
+        return 0;
+    }
+#endif
 #if USE_EPOLL
     struct epoll_event epoll_event;
     epoll_event.events = 0;
@@ -847,6 +2382,7 @@ int async_modify_old_school(async_t *async, int fd, int readable, int writable)
     if (kevent(async->poll_fd, changes, 2, NULL, 0, NULL) < 0)
         return -1;
 #endif
+    registration->interest = interest;
     async_wake_up(async);
     FSTRACE(ASYNC_MODIFY_OLD_SCHOOL, async->uid, fd, readable, writable);
     return 0;
@@ -857,27 +2393,49 @@ FSTRACE_DECL(ASYNC_UNREGISTER, "UID=%64u FD=%d");
 
 int async_unregister(async_t *async, int fd)
 {
+    async_registration_t *registration = get_registration(async, fd);
+    if (registration == NULL) {
+        errno = EBADF;
+        FSTRACE(ASYNC_UNREGISTER_FAIL, async->uid, fd);
+        return -1;
+    }
+#if ASYNC_IO_URING
+    if (async->uring) {
+        if (async_uring_poll_remove(async->uring,
+                                    uring_user_data(registration, fd)) < 0) {
+            FSTRACE(ASYNC_UNREGISTER_FAIL, async->uid, fd);
+            return -1;
+        }
+    } else
+#endif
 #if USE_EPOLL
     if (epoll_ctl(async->poll_fd, EPOLL_CTL_DEL, fd, NULL) < 0) {
         FSTRACE(ASYNC_UNREGISTER_FAIL, async->uid, fd);
         return -1;
     }
 #else
-    struct kevent changes[2];
-    EV_SET(&changes[0], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
-    EV_SET(&changes[1], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
-    if (kevent(async->poll_fd, changes, 2, NULL, 0, NULL) < 0) {
-        FSTRACE(ASYNC_UNREGISTER_FAIL, async->uid, fd);
-        return -1;
+    {
+        /* Old-school registrations have both filters, possibly
+         * disabled; the others only have the filters of their
+         * interest. */
+        bool both = registration->level_triggered;
+        struct kevent changes[2];
+        int n = 0;
+        if (both || registration->interest & ASYNC_READABLE)
+            EV_SET(&changes[n++], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        if (both || registration->interest & ASYNC_WRITABLE)
+            EV_SET(&changes[n++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        if (kevent(async->poll_fd, changes, n, NULL, 0, NULL) < 0) {
+            FSTRACE(ASYNC_UNREGISTER_FAIL, async->uid, fd);
+            return -1;
+        }
     }
 #endif
-    avl_elem_t *element =
-        avl_tree_pop(async->registrations, (void *) (intptr_t) fd);
-    assert(element != NULL);
-    async_event_t *event = (async_event_t *) avl_elem_get_value(element);
+    async_event_t *event = registration->event;
+    registration->registered = false;
+    registration->event = NULL;
     if (event != ASYNC_SENTINEL_EVENT)
         destroy_async_event(event);
-    destroy_avl_element(element);
     FSTRACE(ASYNC_UNREGISTER, async->uid, fd);
     return 0;
 }
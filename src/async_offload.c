@@ -0,0 +1,204 @@
+/*
+ * A fixed-size pool of worker threads for blocking or CPU-heavy work.
+ * The pool is started on the first async_offload() call. Completed jobs
+ * are handed back to the main loop with async_execute_remote(), which
+ * lets the main loop pick up the completions in batches.
+ */
+
+#include <errno.h>
+#include <fstrace.h>
+#include <pthread.h>
+
+#include <fsdyn/fsalloc.h>
+
+#include "async_imp.h"
+
+typedef struct job {
+    async_offload_t *offload;
+    struct job *next; /* in queue */
+    struct job *prev_job, *next_job; /* in jobs */
+    void (*work)(void *arg);
+    void *arg;
+    action_1 completion;
+} job_t;
+
+struct async_offload {
+    async_t *async;
+    uint64_t uid;
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    job_t *queue, *queue_tail; /* waiting for a worker */
+    bool stopping;
+    unsigned thread_count;
+    pthread_t *threads;
+    /* all jobs whose completion is outstanding; only accessed by the
+     * main loop */
+    job_t *jobs;
+};
+
+static void complete(job_t *job);
+
+static void *serve(void *arg)
+{
+    async_offload_t *offload = arg;
+    pthread_mutex_lock(&offload->lock);
+    for (;;) {
+        while (!offload->queue && !offload->stopping)
+            pthread_cond_wait(&offload->work_available, &offload->lock);
+        if (offload->stopping)
+            break;
+        job_t *job = offload->queue;
+        offload->queue = job->next;
+        if (!offload->queue)
+            offload->queue_tail = NULL;
+        pthread_mutex_unlock(&offload->lock);
+        job->work(job->arg);
+        async_execute_remote(offload->async,
+                             (action_1) { job, (act_1) complete });
+        pthread_mutex_lock(&offload->lock);
+    }
+    pthread_mutex_unlock(&offload->lock);
+    return NULL;
+}
+
+FSTRACE_DECL(ASYNC_OFFLOAD_COMPLETE, "UID=%64u OBJ=%p ACT=%p");
+
+static void unlink_job(job_t *job)
+{
+    if (job->prev_job)
+        job->prev_job->next_job = job->next_job;
+    else
+        job->offload->jobs = job->next_job;
+    if (job->next_job)
+        job->next_job->prev_job = job->prev_job;
+}
+
+static void complete(job_t *job)
+{
+    FSTRACE(ASYNC_OFFLOAD_COMPLETE, job->offload->uid, job->completion.obj,
+            job->completion.act);
+    action_1 completion = job->completion;
+    unlink_job(job);
+    fsfree(job);
+    action_1_perf(completion);
+}
+
+static void stop_threads(async_offload_t *offload, unsigned count)
+{
+    pthread_mutex_lock(&offload->lock);
+    offload->stopping = true;
+    pthread_cond_broadcast(&offload->work_available);
+    pthread_mutex_unlock(&offload->lock);
+    unsigned i;
+    for (i = 0; i < count; i++)
+        pthread_join(offload->threads[i], NULL);
+}
+
+static void free_jobs(job_t *jobs)
+{
+    while (jobs) {
+        job_t *job = jobs;
+        jobs = job->next_job;
+        fsfree(job);
+    }
+}
+
+static void free_offload(async_offload_t *offload)
+{
+    pthread_cond_destroy(&offload->work_available);
+    pthread_mutex_destroy(&offload->lock);
+    fsfree(offload->threads);
+    fsfree(offload);
+}
+
+FSTRACE_DECL(ASYNC_OFFLOAD_CREATE, "UID=%64u PTR=%p ASYNC=%p THREADS=%u");
+FSTRACE_DECL(ASYNC_OFFLOAD_CREATE_FAIL, "ASYNC=%p ERRNO=%e");
+
+static async_offload_t *make_offload(async_t *async, unsigned thread_count)
+{
+    async_offload_t *offload = fsalloc(sizeof *offload);
+    offload->async = async;
+    offload->uid = fstrace_get_unique_id();
+    pthread_mutex_init(&offload->lock, NULL);
+    pthread_cond_init(&offload->work_available, NULL);
+    offload->queue = offload->queue_tail = NULL;
+    offload->stopping = false;
+    offload->thread_count = thread_count;
+    offload->threads = fscalloc(thread_count, sizeof *offload->threads);
+    offload->jobs = NULL;
+    unsigned i;
+    for (i = 0; i < thread_count; i++) {
+        int err = pthread_create(&offload->threads[i], NULL, serve, offload);
+        if (err) {
+            errno = err;
+            FSTRACE(ASYNC_OFFLOAD_CREATE_FAIL, async);
+            stop_threads(offload, i);
+            free_offload(offload);
+            errno = err;
+            return NULL;
+        }
+    }
+    FSTRACE(ASYNC_OFFLOAD_CREATE, offload->uid, offload, async, thread_count);
+    return offload;
+}
+
+FSTRACE_DECL(ASYNC_OFFLOAD_DESTROY, "UID=%64u");
+
+void async_offload_destroy(async_offload_t *offload)
+{
+    FSTRACE(ASYNC_OFFLOAD_DESTROY, offload->uid);
+    stop_threads(offload, offload->thread_count);
+    /* The pending completions are discarded by destroy_async(). */
+    free_jobs(offload->jobs);
+    free_offload(offload);
+}
+
+FSTRACE_DECL(ASYNC_SET_OFFLOAD_THREADS, "UID=%64u COUNT=%u");
+FSTRACE_DECL(ASYNC_SET_OFFLOAD_THREADS_FAIL, "UID=%64u ERRNO=%e");
+
+int async_set_offload_threads(async_t *async, unsigned count)
+{
+    if (async->offload || count == 0) {
+        errno = async->offload ? EBUSY : EINVAL;
+        FSTRACE(ASYNC_SET_OFFLOAD_THREADS_FAIL, async->uid);
+        return -1;
+    }
+    FSTRACE(ASYNC_SET_OFFLOAD_THREADS, async->uid, count);
+    async->offload_threads = count;
+    return 0;
+}
+
+FSTRACE_DECL(ASYNC_OFFLOAD, "UID=%64u WORK=%p ARG=%p OBJ=%p ACT=%p");
+
+int async_offload(async_t *async, void (*work)(void *arg), void *arg,
+                  action_1 completion)
+{
+    if (!async->offload) {
+        async->offload = make_offload(async, async->offload_threads);
+        if (!async->offload)
+            return -1;
+    }
+    async_offload_t *offload = async->offload;
+    FSTRACE(ASYNC_OFFLOAD, offload->uid, work, arg, completion.obj,
+            completion.act);
+    job_t *job = fsalloc(sizeof *job);
+    job->offload = offload;
+    job->work = work;
+    job->arg = arg;
+    job->completion = completion;
+    job->prev_job = NULL;
+    job->next_job = offload->jobs;
+    if (offload->jobs)
+        offload->jobs->prev_job = job;
+    offload->jobs = job;
+    job->next = NULL;
+    pthread_mutex_lock(&offload->lock);
+    if (offload->queue_tail)
+        offload->queue_tail->next = job;
+    else
+        offload->queue = job;
+    offload->queue_tail = job;
+    pthread_cond_signal(&offload->work_available);
+    pthread_mutex_unlock(&offload->lock);
+    return 0;
+}
@@ -0,0 +1,261 @@
+/*
+ * A minimal io_uring(7) submission and completion ring for Linux
+ * systems. The ring is accessed with raw system calls so no liburing
+ * is needed. async.c uses it in place of epoll(7) for readiness
+ * polling when async is built with ASYNC_IO_URING set.
+ */
+
+#include <errno.h>
+#include <fstrace.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <fsdyn/fsalloc.h>
+
+#include "async_imp.h"
+
+#if defined(__linux__) && ASYNC_IO_URING
+
+#include <endian.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct async_uring {
+    int fd;
+    void *ring;
+    size_t ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    unsigned sq_entries;
+    unsigned *sq_khead, *sq_ktail, *sq_kflags, sq_mask;
+    unsigned *cq_khead, *cq_ktail, cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+enum {
+    REQUIRED_FEATURES = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+        IORING_FEAT_EXT_ARG |
+        /* Multishot polling appeared in the same release (5.13). */
+        IORING_FEAT_RSRC_TAGS,
+};
+
+static unsigned *ring_field(async_uring_t *uring, unsigned offset)
+{
+    return (unsigned *) ((char *) uring->ring + offset);
+}
+
+FSTRACE_DECL(ASYNC_URING_SETUP_FAIL, "ERRNO=%e");
+FSTRACE_DECL(ASYNC_URING_UNSUPPORTED, "FEATURES=0x%x");
+FSTRACE_DECL(ASYNC_URING_MMAP_FAIL, "ERRNO=%e");
+FSTRACE_DECL(ASYNC_URING_CREATE, "PTR=%p FD=%d ENTRIES=%u");
+
+async_uring_t *async_uring_create(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof params);
+    int fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0) {
+        FSTRACE(ASYNC_URING_SETUP_FAIL);
+        return NULL;
+    }
+    if ((params.features & REQUIRED_FEATURES) != REQUIRED_FEATURES) {
+        FSTRACE(ASYNC_URING_UNSUPPORTED, params.features);
+        close(fd);
+        errno = ENOSYS;
+        return NULL;
+    }
+    async_uring_t *uring = fsalloc(sizeof *uring);
+    uring->fd = fd;
+    uring->ring_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > uring->ring_size)
+        uring->ring_size = cq_size;
+    uring->ring = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (uring->ring == MAP_FAILED) {
+        FSTRACE(ASYNC_URING_MMAP_FAIL);
+        close(fd);
+        fsfree(uring);
+        return NULL;
+    }
+    uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (uring->sqes == MAP_FAILED) {
+        FSTRACE(ASYNC_URING_MMAP_FAIL);
+        munmap(uring->ring, uring->ring_size);
+        close(fd);
+        fsfree(uring);
+        return NULL;
+    }
+    uring->sq_entries = params.sq_entries;
+    uring->sq_khead = ring_field(uring, params.sq_off.head);
+    uring->sq_ktail = ring_field(uring, params.sq_off.tail);
+    uring->sq_kflags = ring_field(uring, params.sq_off.flags);
+    uring->sq_mask = *ring_field(uring, params.sq_off.ring_mask);
+    uring->cq_khead = ring_field(uring, params.cq_off.head);
+    uring->cq_ktail = ring_field(uring, params.cq_off.tail);
+    uring->cq_mask = *ring_field(uring, params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *) ((char *) uring->ring +
+                                           params.cq_off.cqes);
+    /* The submission queue entries are always used in order. */
+    unsigned *sq_array = ring_field(uring, params.sq_off.array);
+    unsigned i;
+    for (i = 0; i < params.sq_entries; i++)
+        sq_array[i] = i;
+    FSTRACE(ASYNC_URING_CREATE, uring, fd, params.sq_entries);
+    return uring;
+}
+
+FSTRACE_DECL(ASYNC_URING_DESTROY, "PTR=%p");
+
+void async_uring_destroy(async_uring_t *uring)
+{
+    FSTRACE(ASYNC_URING_DESTROY, uring);
+    munmap(uring->sqes, uring->sqes_size);
+    munmap(uring->ring, uring->ring_size);
+    close(uring->fd);
+    fsfree(uring);
+}
+
+int async_uring_fd(async_uring_t *uring)
+{
+    return uring->fd;
+}
+
+static unsigned pending_submissions(async_uring_t *uring)
+{
+    return __atomic_load_n(uring->sq_ktail, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(uring->sq_khead, __ATOMIC_ACQUIRE);
+}
+
+static unsigned ready_completions(async_uring_t *uring)
+{
+    return __atomic_load_n(uring->cq_ktail, __ATOMIC_ACQUIRE) -
+        *uring->cq_khead;
+}
+
+static int enter(async_uring_t *uring, unsigned to_submit,
+                 unsigned min_complete, unsigned flags, const void *arg,
+                 size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, uring->fd, to_submit, min_complete,
+                   flags, arg, argsz);
+}
+
+FSTRACE_DECL(ASYNC_URING_SQ_FULL, "PTR=%p");
+FSTRACE_DECL(ASYNC_URING_FLUSH_FAIL, "PTR=%p ERRNO=%e");
+
+/* Return NULL and set errno if the submission queue is full and cannot
+ * be flushed. */
+static struct io_uring_sqe *get_sqe(async_uring_t *uring)
+{
+    while (pending_submissions(uring) >= uring->sq_entries) {
+        FSTRACE(ASYNC_URING_SQ_FULL, uring);
+        if (enter(uring, uring->sq_entries, 0, 0, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            FSTRACE(ASYNC_URING_FLUSH_FAIL, uring);
+            return NULL;
+        }
+    }
+    unsigned tail = *uring->sq_ktail;
+    struct io_uring_sqe *sqe = &uring->sqes[tail & uring->sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
+
+static void push_sqe(async_uring_t *uring)
+{
+    __atomic_store_n(uring->sq_ktail, *uring->sq_ktail + 1, __ATOMIC_RELEASE);
+}
+
+FSTRACE_DECL(ASYNC_URING_POLL_ADD,
+             "PTR=%p USER-DATA=%64u FD=%d MASK=0x%x MULTI=%b");
+
+int async_uring_poll_add(async_uring_t *uring, uint64_t user_data, int fd,
+                         uint32_t poll_mask, bool multishot)
+{
+    FSTRACE(ASYNC_URING_POLL_ADD, uring, user_data, fd, poll_mask, multishot);
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+    poll_mask = poll_mask << 16 | poll_mask >> 16;
+#endif
+    sqe->poll32_events = poll_mask;
+    if (multishot)
+        sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = user_data;
+    push_sqe(uring);
+    return 0;
+}
+
+FSTRACE_DECL(ASYNC_URING_POLL_REMOVE, "PTR=%p USER-DATA=%64u");
+
+int async_uring_poll_remove(async_uring_t *uring, uint64_t user_data)
+{
+    FSTRACE(ASYNC_URING_POLL_REMOVE, uring, user_data);
+    struct io_uring_sqe *sqe = get_sqe(uring);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = user_data;
+    sqe->user_data = ASYNC_URING_IGNORE;
+    push_sqe(uring);
+    return 0;
+}
+
+FSTRACE_DECL(ASYNC_URING_ENTER, "PTR=%p SUBMIT=%u DELAY-NS=%64d");
+FSTRACE_DECL(ASYNC_URING_ENTER_FAIL, "PTR=%p ERRNO=%e");
+
+int async_uring_enter(async_uring_t *uring, int64_t ns)
+{
+    unsigned to_submit = pending_submissions(uring);
+    unsigned flags = 0, min_complete = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = { 0 };
+    if (ns != 0) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        min_complete = 1;
+        if (ns > 0) {
+            ts.tv_sec = ns / 1000000000;
+            ts.tv_nsec = ns % 1000000000;
+            arg.ts = (uint64_t) (uintptr_t) &ts;
+        }
+    } else if (__atomic_load_n(uring->sq_kflags, __ATOMIC_ACQUIRE) &
+               IORING_SQ_CQ_OVERFLOW)
+        flags = IORING_ENTER_GETEVENTS;
+    else if (!to_submit)
+        return ready_completions(uring); /* no need for a system call */
+    FSTRACE(ASYNC_URING_ENTER, uring, to_submit, ns);
+    if (enter(uring, to_submit, min_complete, flags,
+              flags & IORING_ENTER_EXT_ARG ? &arg : NULL,
+              flags & IORING_ENTER_EXT_ARG ? sizeof arg : 0) < 0 &&
+        errno != ETIME && errno != EBUSY) {
+        FSTRACE(ASYNC_URING_ENTER_FAIL, uring);
+        return -1;
+    }
+    return ready_completions(uring);
+}
+
+bool async_uring_reap(async_uring_t *uring,
+                      async_uring_completion_t *completion)
+{
+    unsigned head = *uring->cq_khead;
+    if (head == __atomic_load_n(uring->cq_ktail, __ATOMIC_ACQUIRE))
+        return false;
+    struct io_uring_cqe *cqe = &uring->cqes[head & uring->cq_mask];
+    completion->user_data = cqe->user_data;
+    completion->res = cqe->res;
+    completion->more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+    __atomic_store_n(uring->cq_khead, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * A watchdog thread that reports main loop callbacks that run longer
+ * than a threshold. The loop merely bumps a sequence number around
+ * each callback; the watchdog samples it periodically and considers
+ * the loop stalled when the same callback is seen running for the
+ * threshold.
+ */
+
+#include <errno.h>
+#include <fstrace.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_EXECINFO
+#include <execinfo.h>
+#endif
+
+#include <fsdyn/fsalloc.h>
+
+#include "async_imp.h"
+
+/* The loop thread is interrupted with this signal to capture its
+ * backtrace. */
+#define WATCHDOG_SIGNAL SIGURG
+
+enum {
+    WATCHDOG_BT_DEPTH = 31,
+    MIN_PERIOD = 1 * ASYNC_MS,
+    MAX_PERIOD = 100 * ASYNC_MS,
+    CAPTURE_WAIT_MS = 100,
+};
+
+struct async_watchdog {
+    uint64_t uid;
+    uint64_t threshold, period;
+    async_stall_action sink;
+    pthread_t thread;
+    bool stop;
+    /* written by the loop */
+    uint64_t seq; /* odd while a callback is running */
+    void *act;
+    pthread_t loop_thread; /* written once, before loop_thread_known */
+    bool loop_thread_known;
+};
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec t = {
+        .tv_sec = ns / 1000000000,
+        .tv_nsec = ns % 1000000000,
+    };
+    while (nanosleep(&t, &t) < 0 && errno == EINTR)
+        ;
+}
+
+#ifdef HAVE_EXECINFO
+/* The signal handler is process-wide, so the watchdogs take turns
+ * with the capture buffer. The handler is installed while there are
+ * watchdogs and the application's disposition is restored afterwards. */
+static struct {
+    pthread_mutex_t lock;
+    unsigned users;
+    struct sigaction saved;
+    /* the callback to capture */
+    async_watchdog_t *watchdog;
+    uint64_t seq;
+    void *frames[WATCHDOG_BT_DEPTH];
+    int depth;
+    int done; /* 1 if captured, -1 if the callback was over */
+} capture = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* The handler runs in the loop thread, so the sequence number cannot
+ * change under it. If it has changed already, the signal landed after
+ * the callback and the backtrace would belong to something else. */
+static void capture_backtrace(int signo)
+{
+    async_watchdog_t *watchdog =
+        __atomic_load_n(&capture.watchdog, __ATOMIC_ACQUIRE);
+    if (watchdog == NULL)
+        return;
+    int err = errno;
+    if (__atomic_load_n(&watchdog->seq, __ATOMIC_RELAXED) != capture.seq)
+        __atomic_store_n(&capture.done, -1, __ATOMIC_RELEASE);
+    else {
+        capture.depth = backtrace(capture.frames, WATCHDOG_BT_DEPTH);
+        __atomic_store_n(&capture.done, 1, __ATOMIC_RELEASE);
+    }
+    errno = err;
+}
+
+FSTRACE_DECL(ASYNC_WATCHDOG_SIGNAL_IN_USE, "SIGNAL=%d");
+
+/* Return false (with errno set) if the application has a handler of
+ * its own for the signal. */
+static bool install_capture_handler(void)
+{
+    pthread_mutex_lock(&capture.lock);
+    if (capture.users) {
+        capture.users++;
+        pthread_mutex_unlock(&capture.lock);
+        return true;
+    }
+    if (sigaction(WATCHDOG_SIGNAL, NULL, &capture.saved) < 0) {
+        pthread_mutex_unlock(&capture.lock);
+        return false;
+    }
+    if (capture.saved.sa_handler != SIG_DFL &&
+        capture.saved.sa_handler != SIG_IGN) {
+        FSTRACE(ASYNC_WATCHDOG_SIGNAL_IN_USE, WATCHDOG_SIGNAL);
+        pthread_mutex_unlock(&capture.lock);
+        errno = EBUSY;
+        return false;
+    }
+    /* backtrace() may allocate memory on the first call; get that over
+     * with outside the signal handler. */
+    void *frame;
+    (void) backtrace(&frame, 1);
+    struct sigaction action = {
+        .sa_handler = capture_backtrace,
+        .sa_flags = SA_RESTART | SA_ONSTACK,
+    };
+    sigemptyset(&action.sa_mask);
+    if (sigaction(WATCHDOG_SIGNAL, &action, NULL) < 0) {
+        pthread_mutex_unlock(&capture.lock);
+        return false;
+    }
+    capture.users = 1;
+    pthread_mutex_unlock(&capture.lock);
+    return true;
+}
+
+static void uninstall_capture_handler(void)
+{
+    pthread_mutex_lock(&capture.lock);
+    if (!--capture.users)
+        (void) sigaction(WATCHDOG_SIGNAL, &capture.saved, NULL);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+FSTRACE_DECL(ASYNC_WATCHDOG_CAPTURE_TIMEOUT, "UID=%64u");
+FSTRACE_DECL(ASYNC_WATCHDOG_CAPTURE_MISSED, "UID=%64u");
+
+/* Return the depth of the backtrace or 0 if the callback is over or
+ * the loop thread did not respond in time. */
+static int capture_loop_thread(async_watchdog_t *watchdog, uint64_t seq,
+                               void **frames)
+{
+    if (!__atomic_load_n(&watchdog->loop_thread_known, __ATOMIC_ACQUIRE))
+        return 0;
+    int depth = 0;
+    pthread_mutex_lock(&capture.lock);
+    capture.seq = seq;
+    __atomic_store_n(&capture.done, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&capture.watchdog, watchdog, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&watchdog->seq, __ATOMIC_ACQUIRE) == seq &&
+        pthread_kill(watchdog->loop_thread, WATCHDOG_SIGNAL) == 0) {
+        int i, done = 0;
+        for (i = 0; i < CAPTURE_WAIT_MS; i++) {
+            done = __atomic_load_n(&capture.done, __ATOMIC_ACQUIRE);
+            if (done)
+                break;
+            sleep_ns(ASYNC_MS);
+        }
+        if (done > 0) {
+            depth = capture.depth;
+            memcpy(frames, capture.frames, depth * sizeof *frames);
+        } else if (done < 0)
+            FSTRACE(ASYNC_WATCHDOG_CAPTURE_MISSED, watchdog->uid);
+        else
+            FSTRACE(ASYNC_WATCHDOG_CAPTURE_TIMEOUT, watchdog->uid);
+    }
+    /* A late signal finds no watchdog and does nothing. */
+    __atomic_store_n(&capture.watchdog, NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&capture.lock);
+    return depth;
+}
+#endif
+
+FSTRACE_DECL(ASYNC_WATCHDOG_STALL, "UID=%64u ACT=%p DURATION=%64u");
+
+static void report(async_watchdog_t *watchdog, uint64_t seq, void *act,
+                   uint64_t duration)
+{
+    FSTRACE(ASYNC_WATCHDOG_STALL, watchdog->uid, act, duration);
+    async_stall_t stall = {
+        .act = act,
+        .duration = duration,
+    };
+#ifdef HAVE_EXECINFO
+    void *frames[WATCHDOG_BT_DEPTH];
+    stall.backtrace_depth = capture_loop_thread(watchdog, seq, frames);
+    if (stall.backtrace_depth)
+        stall.backtrace = frames;
+#endif
+    watchdog->sink.act(watchdog->sink.obj, &stall);
+}
+
+static void *watch(void *arg)
+{
+    async_watchdog_t *watchdog = arg;
+    uint64_t watched_seq = 0, reported_seq = 0, since = 0;
+    while (!__atomic_load_n(&watchdog->stop, __ATOMIC_ACQUIRE)) {
+        sleep_ns(watchdog->period);
+        uint64_t now = monotonic_ns();
+        uint64_t seq = __atomic_load_n(&watchdog->seq, __ATOMIC_ACQUIRE);
+        if (!(seq & 1))
+            continue;
+        if (seq != watched_seq) {
+            watched_seq = seq;
+            since = now;
+            continue;
+        }
+        if (seq == reported_seq || now - since < watchdog->threshold)
+            continue;
+        void *act = __atomic_load_n(&watchdog->act, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&watchdog->seq, __ATOMIC_ACQUIRE) != seq)
+            continue;
+        report(watchdog, seq, act, now - since);
+        reported_seq = seq;
+    }
+    return NULL;
+}
+
+void async_watchdog_enter(async_watchdog_t *watchdog, void *act)
+{
+    if (!watchdog->loop_thread_known) {
+        watchdog->loop_thread = pthread_self();
+        __atomic_store_n(&watchdog->loop_thread_known, true,
+                         __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&watchdog->act, act, __ATOMIC_RELAXED);
+    __atomic_store_n(&watchdog->seq, watchdog->seq + 1, __ATOMIC_RELEASE);
+}
+
+void async_watchdog_leave(async_watchdog_t *watchdog)
+{
+    /* The watchdog may have been started by the callback. */
+    __atomic_store_n(&watchdog->seq, watchdog->seq + (watchdog->seq & 1),
+                     __ATOMIC_RELEASE);
+}
+
+FSTRACE_DECL(ASYNC_WATCHDOG_CREATE, "UID=%64u THRESHOLD=%64u");
+FSTRACE_DECL(ASYNC_WATCHDOG_CREATE_FAIL, "UID=%64u ERRNO=%e");
+
+async_watchdog_t *async_watchdog_create(uint64_t uid, uint64_t threshold,
+                                        async_stall_action sink)
+{
+    async_watchdog_t *watchdog = fsalloc(sizeof *watchdog);
+    watchdog->uid = uid;
+    watchdog->threshold = threshold;
+    watchdog->period = threshold / 4;
+    if (watchdog->period < MIN_PERIOD)
+        watchdog->period = MIN_PERIOD;
+    else if (watchdog->period > MAX_PERIOD)
+        watchdog->period = MAX_PERIOD;
+    watchdog->sink = sink;
+    watchdog->stop = false;
+    watchdog->seq = 0;
+    watchdog->act = NULL;
+    watchdog->loop_thread_known = false;
+#ifdef HAVE_EXECINFO
+    if (!install_capture_handler()) {
+        FSTRACE(ASYNC_WATCHDOG_CREATE_FAIL, uid);
+        fsfree(watchdog);
+        return NULL;
+    }
+#endif
+    int err = pthread_create(&watchdog->thread, NULL, watch, watchdog);
+    if (err) {
+#ifdef HAVE_EXECINFO
+        uninstall_capture_handler();
+#endif
+        errno = err;
+        FSTRACE(ASYNC_WATCHDOG_CREATE_FAIL, uid);
+        fsfree(watchdog);
+        return NULL;
+    }
+    FSTRACE(ASYNC_WATCHDOG_CREATE, uid, threshold);
+    return watchdog;
+}
+
+FSTRACE_DECL(ASYNC_WATCHDOG_DESTROY, "UID=%64u");
+
+void async_watchdog_destroy(async_watchdog_t *watchdog)
+{
+    FSTRACE(ASYNC_WATCHDOG_DESTROY, watchdog->uid);
+    __atomic_store_n(&watchdog->stop, true, __ATOMIC_RELEASE);
+    pthread_join(watchdog->thread, NULL);
+#ifdef HAVE_EXECINFO
+    uninstall_capture_handler();
+#endif
+    fsfree(watchdog);
+}
@@ -32,6 +32,7 @@ struct jsonyield {
     jsonyield_state_t state;
     bytestream_1 *frame;
     byte_array_t *buffer;
+    async_once_t retry; /* coalesces the callbacks for partial frames */
 };
 
 FSTRACE_DECL(ASYNC_JSONYIELD_CREATE,
@@ -49,6 +50,7 @@ jsonyield_t *open_jsonyield(async_t *async, bytestream_1 source,
     yield->callback = NULL_ACTION_1;
     yield->state = JSONYIELD_RECEIVING;
     yield->buffer = make_byte_array(max_frame_size);
+    async_once_init(&yield->retry);
     return yield;
 }
 
@@ -123,7 +125,7 @@ static json_thing_t *do_receive(jsonyield_t *yield)
             }
             FSTRACE(ASYNC_JSONYIELD_INPUT_DUMP, yield->uid,
                     byte_array_data(yield->buffer) + read_pos, count);
-            async_execute(yield->async, yield->callback);
+            async_execute_once(yield->async, &yield->retry, yield->callback);
             errno = EAGAIN;
             return NULL;
         }
@@ -138,7 +140,7 @@ static json_thing_t *do_receive(jsonyield_t *yield)
                 set_yield_state(yield, JSONYIELD_RECEIVING);
                 return jsonyield_receive(yield);
             }
-            async_execute(yield->async, yield->callback);
+            async_execute_once(yield->async, &yield->retry, yield->callback);
             errno = EAGAIN;
             return NULL;
         }
@@ -0,0 +1,361 @@
+#ifdef __linux__
+#define _GNU_SOURCE /* for pthread_attr_setaffinity_np() */
+#endif
+
+#include "multiloop.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <linux/filter.h>
+#endif
+
+#include <fsdyn/fsalloc.h>
+#include <fstrace.h>
+
+#include "async_version.h"
+
+typedef struct {
+    multiloop_t *multiloop;
+    unsigned index;
+    async_t *async;
+    int fd; /* owned by server once adopted */
+    tcp_server_t *server; /* handed over to the shard thread */
+    int cpu; /* or -1 if not pinned */
+    pthread_t thread;
+} shard_t;
+
+struct multiloop {
+    uint64_t uid;
+    multiloop_handler_t handler;
+    struct sockaddr_storage address;
+    socklen_t addrlen;
+    unsigned shard_count;
+    shard_t *shards;
+};
+
+FSTRACE_DECL(ASYNC_MULTILOOP_SHARD_START, "UID=%64u SHARD=%u CPU=%d");
+FSTRACE_DECL(ASYNC_MULTILOOP_SHARD_LOOP_FAIL, "UID=%64u SHARD=%u ERRNO=%e");
+FSTRACE_DECL(ASYNC_MULTILOOP_SHARD_STOP, "UID=%64u SHARD=%u");
+
+static void *run_shard(void *arg)
+{
+    shard_t *shard = arg;
+    multiloop_t *multiloop = shard->multiloop;
+    FSTRACE(ASYNC_MULTILOOP_SHARD_START, multiloop->uid, shard->index,
+            shard->cpu);
+    multiloop->handler.start(multiloop->handler.obj, shard->index,
+                             shard->async, shard->server);
+    while (async_loop(shard->async) < 0)
+        if (errno != EINTR) {
+            FSTRACE(ASYNC_MULTILOOP_SHARD_LOOP_FAIL, multiloop->uid,
+                    shard->index);
+            break;
+        }
+    FSTRACE(ASYNC_MULTILOOP_SHARD_STOP, multiloop->uid, shard->index);
+    if (multiloop->handler.stop)
+        multiloop->handler.stop(multiloop->handler.obj, shard->index,
+                                shard->async);
+    return NULL;
+}
+
+static int turn_on_sockopt(int fd, int level, int option)
+{
+    int on = 1;
+    return setsockopt(fd, level, option, &on, sizeof on);
+}
+
+FSTRACE_DECL(ASYNC_MULTILOOP_SOCKET_FAIL, "UID=%64u ERRNO=%e");
+FSTRACE_DECL(ASYNC_MULTILOOP_REUSE_FAIL, "UID=%64u ERRNO=%e");
+FSTRACE_DECL(ASYNC_MULTILOOP_BIND_FAIL, "UID=%64u ERRNO=%e");
+FSTRACE_DECL(ASYNC_MULTILOOP_LISTEN_FAIL, "UID=%64u ERRNO=%e");
+
+static int open_listener(multiloop_t *multiloop)
+{
+    const struct sockaddr *address =
+        (const struct sockaddr *) &multiloop->address;
+    int fd = socket(address->sa_family, SOCK_STREAM, 0);
+    if (fd < 0) {
+        FSTRACE(ASYNC_MULTILOOP_SOCKET_FAIL, multiloop->uid);
+        return -1;
+    }
+    if (turn_on_sockopt(fd, SOL_SOCKET, SO_REUSEADDR) < 0 ||
+        turn_on_sockopt(fd, SOL_SOCKET, SO_REUSEPORT) < 0) {
+        FSTRACE(ASYNC_MULTILOOP_REUSE_FAIL, multiloop->uid);
+        goto fail;
+    }
+    if (bind(fd, address, multiloop->addrlen) < 0) {
+        FSTRACE(ASYNC_MULTILOOP_BIND_FAIL, multiloop->uid);
+        goto fail;
+    }
+    if (listen(fd, 128) < 0) {
+        FSTRACE(ASYNC_MULTILOOP_LISTEN_FAIL, multiloop->uid);
+        goto fail;
+    }
+    /* An ephemeral port has now been chosen for the whole group. */
+    socklen_t addrlen = sizeof multiloop->address;
+    if (getsockname(fd, (struct sockaddr *) &multiloop->address, &addrlen) <
+        0)
+        goto fail;
+    multiloop->addrlen = addrlen;
+    return fd;
+
+fail:;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+#ifdef __linux__
+FSTRACE_DECL(ASYNC_MULTILOOP_AFFINITY_FAIL, "UID=%64u ERRNO=%e");
+FSTRACE_DECL(ASYNC_MULTILOOP_TOO_FEW_CPUS, "UID=%64u SHARDS=%u CPUS=%d");
+
+/* Assign the CPUs available to the process round-robin to the
+ * shards. When steering, a CPU may not be shared, as the filter only
+ * ever selects the first shard of a CPU. */
+static int assign_cpus(multiloop_t *multiloop, unsigned flags)
+{
+    cpu_set_t available;
+    if (sched_getaffinity(0, sizeof available, &available) < 0) {
+        FSTRACE(ASYNC_MULTILOOP_AFFINITY_FAIL, multiloop->uid);
+        return -1;
+    }
+    if ((flags & MULTILOOP_STEER_BY_CPU) &&
+        multiloop->shard_count > CPU_COUNT(&available)) {
+        FSTRACE(ASYNC_MULTILOOP_TOO_FEW_CPUS, multiloop->uid,
+                multiloop->shard_count, CPU_COUNT(&available));
+        errno = EINVAL;
+        return -1;
+    }
+    int cpu = -1;
+    unsigned i;
+    for (i = 0; i < multiloop->shard_count; i++) {
+        do
+            cpu = (cpu + 1) % CPU_SETSIZE;
+        while (!CPU_ISSET(cpu, &available));
+        multiloop->shards[i].cpu = cpu;
+    }
+    return 0;
+}
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+FSTRACE_DECL(ASYNC_MULTILOOP_STEER_FAIL, "UID=%64u ERRNO=%e");
+
+/* The kernel consults the filter for each new connection. It returns
+ * the index (in the order of listen(2) calls) of the listening socket
+ * whose shard is pinned to the CPU that handles the connection. An
+ * out-of-range index, returned for unexpected CPUs, makes the kernel
+ * fall back to its default hash-based selection. */
+static int steer_by_cpu(multiloop_t *multiloop)
+{
+    unsigned n = multiloop->shard_count;
+    struct sock_filter *code = fscalloc(2 * n + 2, sizeof *code);
+    struct sock_filter *p = code;
+    *p++ = (struct sock_filter)
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+    unsigned i;
+    for (i = 0; i < n; i++) {
+        unsigned cpu = multiloop->shards[i].cpu;
+        *p++ = (struct sock_filter)
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpu, 0, 1);
+        *p++ = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, i);
+    }
+    *p++ = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, n);
+    struct sock_fprog program = {
+        .len = p - code,
+        .filter = code,
+    };
+    int status = setsockopt(multiloop->shards[0].fd, SOL_SOCKET,
+                            SO_ATTACH_REUSEPORT_CBPF, &program,
+                            sizeof program);
+    int err = errno;
+    fsfree(code);
+    if (status < 0) {
+        errno = err;
+        FSTRACE(ASYNC_MULTILOOP_STEER_FAIL, multiloop->uid);
+        return -1;
+    }
+    return 0;
+}
+#endif
+#endif
+
+FSTRACE_DECL(ASYNC_MULTILOOP_THREAD_FAIL, "UID=%64u SHARD=%u ERRNO=%e");
+
+static int start_thread(shard_t *shard)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    int err = 0;
+#ifdef __linux__
+    if (shard->cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->cpu, &cpus);
+        err = pthread_attr_setaffinity_np(&attr, sizeof cpus, &cpus);
+    }
+#endif
+    if (!err)
+        err = pthread_create(&shard->thread, &attr, run_shard, shard);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        errno = err;
+        FSTRACE(ASYNC_MULTILOOP_THREAD_FAIL, shard->multiloop->uid,
+                shard->index);
+        return -1;
+    }
+    return 0;
+}
+
+static void quit_shard(shard_t *shard)
+{
+    async_quit_loop(shard->async);
+}
+
+static void stop_threads(multiloop_t *multiloop, unsigned count)
+{
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        shard_t *shard = &multiloop->shards[i];
+        async_execute_remote(shard->async,
+                             (action_1) { shard, (act_1) quit_shard });
+    }
+    for (i = 0; i < count; i++)
+        pthread_join(multiloop->shards[i].thread, NULL);
+}
+
+/* Close the servers and sockets that have not been handed over to a
+ * shard thread and release the rest. */
+static void release(multiloop_t *multiloop, unsigned started)
+{
+    unsigned i;
+    for (i = 0; i < multiloop->shard_count; i++) {
+        shard_t *shard = &multiloop->shards[i];
+        if (i >= started) {
+            if (shard->server)
+                tcp_close_server(shard->server);
+            else if (shard->fd >= 0)
+                close(shard->fd);
+        }
+        if (shard->async)
+            destroy_async(shard->async);
+    }
+    fsfree(multiloop->shards);
+    fsfree(multiloop);
+}
+
+FSTRACE_DECL(ASYNC_MULTILOOP_CREATE,
+             "UID=%64u PTR=%p ADDRESS=%a SHARDS=%u FLAGS=0x%x");
+FSTRACE_DECL(ASYNC_MULTILOOP_ADOPT_FAIL, "UID=%64u SHARD=%u ERRNO=%e");
+FSTRACE_DECL(ASYNC_MULTILOOP_CREATE_FAIL, "UID=%64u ERRNO=%e");
+
+multiloop_t *make_multiloop(const struct sockaddr *address,
+                            socklen_t addrlen, unsigned shard_count,
+                            unsigned flags, multiloop_handler_t handler)
+{
+    if (shard_count == 0 || addrlen > sizeof(struct sockaddr_storage)) {
+        errno = EINVAL;
+        return NULL;
+    }
+#if !defined(__linux__) || !defined(SO_ATTACH_REUSEPORT_CBPF)
+    if (flags & MULTILOOP_STEER_BY_CPU) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+#ifndef __linux__
+    if (flags & MULTILOOP_PIN_THREADS) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+#endif
+    multiloop_t *multiloop = fsalloc(sizeof *multiloop);
+    multiloop->uid = fstrace_get_unique_id();
+    FSTRACE(ASYNC_MULTILOOP_CREATE, multiloop->uid, multiloop, address,
+            addrlen, shard_count, flags);
+    multiloop->handler = handler;
+    memcpy(&multiloop->address, address, addrlen);
+    multiloop->addrlen = addrlen;
+    multiloop->shard_count = shard_count;
+    multiloop->shards = fscalloc(shard_count, sizeof *multiloop->shards);
+    unsigned i;
+    for (i = 0; i < shard_count; i++) {
+        shard_t *shard = &multiloop->shards[i];
+        shard->multiloop = multiloop;
+        shard->index = i;
+        shard->async = NULL;
+        shard->fd = -1;
+        shard->server = NULL;
+        shard->cpu = -1;
+    }
+    for (i = 0; i < shard_count; i++) {
+        shard_t *shard = &multiloop->shards[i];
+        shard->fd = open_listener(multiloop);
+        if (shard->fd < 0)
+            goto fail;
+        shard->async = make_async();
+        if (!shard->async)
+            goto fail;
+        shard->server = tcp_adopt_server(shard->async, shard->fd);
+        if (!shard->server) {
+            FSTRACE(ASYNC_MULTILOOP_ADOPT_FAIL, multiloop->uid, i);
+            goto fail;
+        }
+    }
+#ifdef __linux__
+    if ((flags & (MULTILOOP_PIN_THREADS | MULTILOOP_STEER_BY_CPU)) &&
+        assign_cpus(multiloop, flags) < 0)
+        goto fail;
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    if ((flags & MULTILOOP_STEER_BY_CPU) && steer_by_cpu(multiloop) < 0)
+        goto fail;
+#endif
+#endif
+    for (i = 0; i < shard_count; i++)
+        if (start_thread(&multiloop->shards[i]) < 0) {
+            int err = errno;
+            stop_threads(multiloop, i);
+            release(multiloop, i);
+            errno = err;
+            FSTRACE(ASYNC_MULTILOOP_CREATE_FAIL, multiloop->uid);
+            return NULL;
+        }
+    return multiloop;
+
+fail:;
+    int err = errno;
+    release(multiloop, 0);
+    errno = err;
+    FSTRACE(ASYNC_MULTILOOP_CREATE_FAIL, multiloop->uid);
+    return NULL;
+}
+
+FSTRACE_DECL(ASYNC_MULTILOOP_DESTROY, "UID=%64u");
+
+void destroy_multiloop(multiloop_t *multiloop)
+{
+    FSTRACE(ASYNC_MULTILOOP_DESTROY, multiloop->uid);
+    stop_threads(multiloop, multiloop->shard_count);
+    release(multiloop, multiloop->shard_count);
+}
+
+unsigned multiloop_get_shard_count(multiloop_t *multiloop)
+{
+    return multiloop->shard_count;
+}
+
+async_t *multiloop_get_async(multiloop_t *multiloop, unsigned shard)
+{
+    return multiloop->shards[shard].async;
+}
+
+const struct sockaddr *multiloop_get_address(multiloop_t *multiloop,
+                                             socklen_t *addrlen)
+{
+    *addrlen = multiloop->addrlen;
+    return (const struct sockaddr *) &multiloop->address;
+}
@@ -13,7 +13,7 @@ struct pacer {
     uint64_t uid;
     double rate, initial, maximum;
     uint64_t start_time;
-    async_timer_t *timer;
+    async_timer_t timer;
     list_t *queue;
 };
 
@@ -25,6 +25,8 @@ struct pacer_ticket {
     list_elem_t *iter;
 };
 
+static void pacer_probe(pacer_t *pacer);
+
 FSTRACE_DECL(ASYNC_PACER_CREATE,
              "UID=%64u PTR=%p ASYNC=%p RATE=%f INIT=%f MAX=%f START=%64u");
 
@@ -40,7 +42,7 @@ pacer_t *make_pacer(async_t *async, double rate, double initial, double maximum,
     pacer->initial = initial;
     pacer->maximum = maximum;
     pacer->start_time = start_time;
-    pacer->timer = NULL;
+    async_timer_init(&pacer->timer, (action_1) { pacer, (act_1) pacer_probe });
     pacer->queue = make_list();
     return pacer;
 }
@@ -51,8 +53,7 @@ void destroy_pacer(pacer_t *pacer)
 {
     FSTRACE(ASYNC_PACER_DESTROY, pacer->uid);
     assert(pacer->async != NULL);
-    if (pacer->timer)
-        async_timer_cancel(pacer->async, pacer->timer);
+    async_timer_stop(pacer->async, &pacer->timer);
     while (!list_empty(pacer->queue))
         fsfree((void *) list_pop_first(pacer->queue));
     destroy_list(pacer->queue);
@@ -69,8 +70,6 @@ static double calc_available(pacer_t *pacer, uint64_t t)
     return amount;
 }
 
-static void pacer_probe(pacer_t *pacer);
-
 static void start_timer(pacer_ticket_t *ticket, double amount, uint64_t now)
 {
     pacer_t *pacer = ticket->pacer;
@@ -85,9 +84,8 @@ static void start_timer(pacer_ticket_t *ticket, double amount, uint64_t now)
     }
     if (time_to_wait < 0) /* guard against uint64_t underflow */
         time_to_wait = 0;
-    pacer->timer = async_timer_start(pacer->async,
-                                     now + (uint64_t)(time_to_wait * ASYNC_S),
-                                     (action_1) { pacer, (act_1) pacer_probe });
+    async_timer_rearm(pacer->async, &pacer->timer,
+                      now + (uint64_t)(time_to_wait * ASYNC_S));
 }
 
 FSTRACE_DECL(ASYNC_PACER_PROBE, "UID=%64u");
@@ -100,19 +98,18 @@ static void pacer_probe(pacer_t *pacer)
     do {
         assert(!list_empty(pacer->queue));
         pacer_ticket_t *ticket = (void *) list_pop_first(pacer->queue);
-        uint64_t now = async_now(pacer->async);
+        uint64_t now = async_recent(pacer->async);
         double amount = calc_available(pacer, now);
         if (amount < ticket->limit) {
             ticket->iter = list_prepend(pacer->queue, ticket);
             start_timer(ticket, amount, now);
             break;
         }
-        pacer->timer = NULL;
         FSTRACE(ASYNC_PACER_TRIGGER, pacer->uid, ticket->uid, ticket->probe.obj,
                 ticket->probe.act);
         action_1_perf(ticket->probe); /* typically calls pacer_get() */
         fsfree(ticket);
-    } while (pacer->timer == NULL && !list_empty(pacer->queue));
+    } while (!async_timer_armed(&pacer->timer) && !list_empty(pacer->queue));
     FSTRACE(ASYNC_PACER_PROBED, pacer->uid);
 }
 
@@ -125,7 +122,7 @@ FSTRACE_DECL(ASYNC_PACER_ENQUEUED,
 pacer_ticket_t *pacer_get(pacer_t *pacer, double limit, double debit,
                           action_1 probe)
 {
-    uint64_t now = async_now(pacer->async);
+    uint64_t now = async_recent(pacer->async);
     double amount = calc_available(pacer, now);
     if (amount >= limit) {
         pacer->initial = amount - debit;
@@ -143,7 +140,7 @@ pacer_ticket_t *pacer_get(pacer_t *pacer, double limit, double debit,
     ticket->debit = debit;
     ticket->probe = probe;
     ticket->iter = list_append(pacer->queue, ticket);
-    if (pacer->timer == NULL)
+    if (!async_timer_armed(&pacer->timer))
         start_timer(ticket, amount, now);
     return ticket;
 }
@@ -155,13 +152,12 @@ void pacer_cancel(pacer_ticket_t *ticket)
     pacer_t *pacer = ticket->pacer;
     FSTRACE(ASYNC_PACER_CANCEL, pacer->uid, ticket->uid);
     if (list_get_first(pacer->queue) == ticket->iter) {
-        assert(pacer->timer != NULL);
-        async_timer_cancel(pacer->async, pacer->timer);
-        pacer->timer = NULL;
+        assert(async_timer_armed(&pacer->timer));
+        async_timer_stop(pacer->async, &pacer->timer);
     }
     list_remove(pacer->queue, ticket->iter);
     fsfree(ticket);
-    if (pacer->timer == NULL && !list_empty(pacer->queue))
+    if (!async_timer_armed(&pacer->timer) && !list_empty(pacer->queue))
         async_execute(pacer->async, (action_1) { pacer, (act_1) pacer_probe });
 }
 
@@ -17,7 +17,7 @@ struct pacerstream {
     size_t min_burst, max_burst;
     uint64_t prev_t;
     action_1 callback;
-    async_timer_t *retry_timer;
+    async_timer_t retry_timer;
 };
 
 FSTRACE_DECL(ASYNC_PACERSTREAM_RETRY, "UID=%64u");
@@ -27,7 +27,6 @@ static void retry(pacerstream_t *pacer)
     if (pacer->async == NULL)
         return;
     FSTRACE(ASYNC_PACERSTREAM_RETRY, pacer->uid);
-    pacer->retry_timer = NULL;
     action_1_perf(pacer->callback);
 }
 
@@ -41,10 +40,7 @@ ssize_t pacerstream_read(pacerstream_t *pacer, void *buf, size_t count)
         errno = EBADF;
         return -1;
     }
-    if (pacer->retry_timer != NULL)
-        async_timer_cancel(pacer->async, pacer->retry_timer);
-    pacer->retry_timer = NULL;
-    uint64_t t = async_now(pacer->async);
+    uint64_t t = async_recent(pacer->async);
     pacer->quota += (t - pacer->prev_t) * 1e-09 * pacer->byterate;
     if (pacer->quota > pacer->max_burst)
         pacer->quota = pacer->max_burst;
@@ -52,13 +48,12 @@ ssize_t pacerstream_read(pacerstream_t *pacer, void *buf, size_t count)
     if (pacer->quota < pacer->min_burst) {
         uint64_t delay = (uint64_t)((pacer->min_burst - pacer->quota) /
                                     pacer->byterate * 1e+09);
-        pacer->retry_timer =
-            async_timer_start(pacer->async, t + delay,
-                              (action_1) { pacer, (act_1) retry });
+        async_timer_rearm(pacer->async, &pacer->retry_timer, t + delay);
         FSTRACE(ASYNC_PACERSTREAM_READ_POSTPONE, pacer->uid, count);
         errno = EAGAIN;
         return -1;
     }
+    async_timer_stop(pacer->async, &pacer->retry_timer);
     if (count > pacer->quota)
         count = (size_t) pacer->quota;
     ssize_t n = bytestream_1_read(pacer->stream, buf, count);
@@ -81,8 +76,7 @@ void pacerstream_close(pacerstream_t *pacer)
     FSTRACE(ASYNC_PACERSTREAM_CLOSE, pacer->uid);
     assert(pacer->async != NULL);
     bytestream_1_close(pacer->stream);
-    if (pacer->retry_timer != NULL)
-        async_timer_cancel(pacer->async, pacer->retry_timer);
+    async_timer_stop(pacer->async, &pacer->retry_timer);
     async_wound(pacer->async, pacer);
     pacer->async = NULL;
 }
@@ -151,7 +145,7 @@ pacerstream_t *pace_stream(async_t *async, bytestream_1 stream, double byterate,
         pacer->min_burst = min_burst;
     pacer->max_burst = max_burst;
     pacer->callback = NULL_ACTION_1;
-    pacer->retry_timer = NULL;
+    async_timer_init(&pacer->retry_timer, (action_1) { pacer, (act_1) retry });
     pacer->quota = 0;
     pacer->prev_t = async_now(pacer->async);
     return pacer;
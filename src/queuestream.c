@@ -22,6 +22,9 @@ struct queuestream {
     bool terminated, closed, released;
     action_1 notifier;
     bool notification_expected;
+    async_once_t notification; /* coalesces the notify() calls */
+    bool coalescing;
+    async_hook_t *flush_hook; /* or NULL */
 };
 
 FSTRACE_DECL(ASYNC_QUEUESTREAM_CREATE, "UID=%64u PTR=%p ASYNC=%p");
@@ -37,6 +40,9 @@ queuestream_t *make_relaxed_queuestream(async_t *async)
     qstr->queue = make_list();
     qstr->notifier = NULL_ACTION_1;
     qstr->notification_expected = false;
+    async_once_init(&qstr->notification);
+    qstr->coalescing = false;
+    qstr->flush_hook = NULL;
     return qstr;
 }
 
@@ -71,6 +77,32 @@ static void notify(queuestream_t *qstr)
     action_1_perf(qstr->notifier);
 }
 
+static void flush(queuestream_t *qstr)
+{
+    async_remove_hook(qstr->async, qstr->flush_hook);
+    qstr->flush_hook = NULL;
+    notify(qstr);
+}
+
+static void schedule_notification(queuestream_t *qstr)
+{
+    if (!qstr->coalescing) {
+        action_1 callback = { qstr, (act_1) notify };
+        async_execute_once(qstr->async, &qstr->notification, callback);
+    } else if (!qstr->flush_hook) {
+        action_1 flush_cb = { qstr, (act_1) flush };
+        qstr->flush_hook = async_add_prepare_hook(qstr->async, flush_cb);
+    }
+}
+
+FSTRACE_DECL(ASYNC_QUEUESTREAM_COALESCE, "UID=%64u");
+
+void queuestream_coalesce(queuestream_t *qstr)
+{
+    FSTRACE(ASYNC_QUEUESTREAM_COALESCE, qstr->uid);
+    qstr->coalescing = true;
+}
+
 FSTRACE_DECL(ASYNC_QUEUESTREAM_ENQUEUE, "UID=%64u STREAM=%p");
 FSTRACE_DECL(ASYNC_QUEUESTREAM_ENQUEUE_POSTHUMOUSLY, "UID=%64u STREAM=%p");
 
@@ -88,7 +120,7 @@ void queuestream_enqueue(queuestream_t *qstr, bytestream_1 stream)
     list_append(qstr->queue, elemstream);
     action_1 callback = { qstr, (act_1) notify };
     bytestream_1_register_callback(stream, callback);
-    async_execute(qstr->async, callback);
+    schedule_notification(qstr);
 }
 
 FSTRACE_DECL(ASYNC_QUEUESTREAM_PUSH, "UID=%64u STREAM=%p");
@@ -109,7 +141,7 @@ void queuestream_push(queuestream_t *qstr, bytestream_1 stream)
     list_prepend(qstr->queue, elemstream);
     action_1 callback = { qstr, (act_1) notify };
     bytestream_1_register_callback(stream, callback);
-    async_execute(qstr->async, callback);
+    schedule_notification(qstr);
 }
 
 FSTRACE_DECL(ASYNC_QUEUESTREAM_ENQUEUE_BYTES, "UID=%64u DATA=%A");
@@ -143,8 +175,7 @@ void queuestream_terminate(queuestream_t *qstr)
     }
     FSTRACE(ASYNC_QUEUESTREAM_TERMINATE, qstr->uid);
     qstr->terminated = true;
-    action_1 callback = { qstr, (act_1) notify };
-    async_execute(qstr->async, callback);
+    schedule_notification(qstr);
 }
 
 static ssize_t do_read(queuestream_t *qstr, void *buf, size_t count)
@@ -220,6 +251,10 @@ void queuestream_close(queuestream_t *qstr)
         list_remove(qstr->queue, head_elem);
     }
     destroy_list(qstr->queue);
+    if (qstr->flush_hook) {
+        async_remove_hook(qstr->async, qstr->flush_hook);
+        qstr->flush_hook = NULL;
+    }
     if (qstr->released)
         async_wound(qstr->async, qstr);
     qstr->closed = true;
@@ -39,6 +39,9 @@ struct tcp_conn {
     uint8_t outbuf[OUTBUF_SIZE];
     int outcursor, outcount;
     uint32_t flags;
+    async_once_t user_probe_once;
+    async_t *migration_target;
+    action_1 migration_action;
 };
 
 struct tcp_server {
@@ -727,6 +730,7 @@ static void push_output(tcp_conn_t *conn)
 }
 
 FSTRACE_DECL(ASYNC_TCP_USER_PROBE_INACTIVE, "UID=%64u");
+FSTRACE_DECL(ASYNC_TCP_USER_PROBE_MIGRATING, "UID=%64u");
 FSTRACE_DECL(ASYNC_TCP_USER_PROBE_CONNECTING, "UID=%64u");
 FSTRACE_DECL(ASYNC_TCP_USER_PROBE_PUSH, "UID=%64u");
 
@@ -736,6 +740,10 @@ static void user_probe(tcp_conn_t *conn)
         FSTRACE(ASYNC_TCP_USER_PROBE_INACTIVE, conn->uid);
         return;
     }
+    if (conn->flags & TCP_FLAG_MIGRATING) {
+        FSTRACE(ASYNC_TCP_USER_PROBE_MIGRATING, conn->uid);
+        return;
+    }
     conn->flags &= ~TCP_FLAG_EGRESS_PENDING;
     if (conn->output.state == CONNECTING) {
         FSTRACE(ASYNC_TCP_USER_PROBE_CONNECTING, conn->uid);
@@ -745,19 +753,35 @@ static void user_probe(tcp_conn_t *conn)
     push_output(conn);
 }
 
+enum {
+    INPUT_READINESS = ASYNC_READABLE | ASYNC_HANGUP | ASYNC_ERROR,
+    OUTPUT_READINESS = ASYNC_WRITABLE | ASYNC_HANGUP | ASYNC_ERROR,
+};
+
 FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_INACTIVE, "UID=%64u");
+FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_MIGRATING, "UID=%64u");
+FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_READINESS, "UID=%64u READINESS=0x%x");
 FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_CONNECTING, "UID=%64u ERROR=%E");
 FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_IN_PROGRESS, "UID=%64u");
 FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_PUSH, "UID=%64u");
 FSTRACE_DECL(ASYNC_TCP_SOCKET_PROBE_NOTIFY, "UID=%64u");
 
-static void socket_probe(tcp_conn_t *conn)
+/* Only the directions indicated by readiness are serviced. */
+static void socket_ready(tcp_conn_t *conn, unsigned readiness)
 {
     if (inactive(conn)) {
         FSTRACE(ASYNC_TCP_SOCKET_PROBE_INACTIVE, conn->uid);
         return;
     }
-    conn->flags &= ~(TCP_FLAG_EPOLL_RECV | TCP_FLAG_EPOLL_SEND);
+    if (conn->flags & TCP_FLAG_MIGRATING) {
+        FSTRACE(ASYNC_TCP_SOCKET_PROBE_MIGRATING, conn->uid);
+        return;
+    }
+    FSTRACE(ASYNC_TCP_SOCKET_PROBE_READINESS, conn->uid, readiness);
+    if (readiness & INPUT_READINESS)
+        conn->flags &= ~TCP_FLAG_EPOLL_RECV;
+    if (readiness & OUTPUT_READINESS)
+        conn->flags &= ~TCP_FLAG_EPOLL_SEND;
     if (conn->input.state == CONNECTING || conn->output.state == CONNECTING) {
         int status, error;
         socklen_t errlen = sizeof error;
@@ -785,11 +809,15 @@ static void socket_probe(tcp_conn_t *conn)
                     set_input_state(conn, CONNECTED);
                 if (conn->output.state == CONNECTING)
                     set_output_state(conn, CONNECTED);
+                /* Both directions have just become available. */
+                readiness |= INPUT_READINESS | OUTPUT_READINESS;
         }
     }
-    FSTRACE(ASYNC_TCP_SOCKET_PROBE_PUSH, conn->uid);
-    push_output(conn);
-    if (conn->input.state == CONNECTED) {
+    if (readiness & OUTPUT_READINESS) {
+        FSTRACE(ASYNC_TCP_SOCKET_PROBE_PUSH, conn->uid);
+        push_output(conn);
+    }
+    if ((readiness & INPUT_READINESS) && conn->input.state == CONNECTED) {
         conn->flags |= TCP_FLAG_INGRESS_PENDING;
         FSTRACE(ASYNC_TCP_SOCKET_PROBE_NOTIFY, conn->uid);
         action_1_perf(conn->notify_input);
@@ -801,7 +829,13 @@ FSTRACE_DECL(ASYNC_TCP_SCHEDULE_USER_PROBE, "UID=%64u");
 static void schedule_user_probe(tcp_conn_t *conn)
 {
     FSTRACE(ASYNC_TCP_SCHEDULE_USER_PROBE, conn->uid);
-    async_execute(conn->async, (action_1) { conn, (act_1) user_probe });
+    async_execute_once(conn->async, &conn->user_probe_once,
+                       (action_1) { conn, (act_1) user_probe });
+}
+
+static void socket_probe(tcp_conn_t *conn)
+{
+    socket_ready(conn, INPUT_READINESS | OUTPUT_READINESS);
 }
 
 FSTRACE_DECL(ASYNC_TCP_SCHEDULE_SOCKET_PROBE, "UID=%64u");
@@ -1185,6 +1219,7 @@ static tcp_conn_t *adopt_connection(async_t *async, uint64_t uid, int connfd)
     conn->outcursor = conn->outcount = 0;
     conn->connection_closed = conn->input_stream_closed = false;
     conn->input.error = conn->output.error = 0;
+    async_once_init(&conn->user_probe_once);
     tcp_unregister_callback(conn);
     conn->fd = connfd;
 #ifdef SO_NOSIGPIPE
@@ -1205,8 +1240,9 @@ static tcp_conn_t *adopt_connection(async_t *async, uint64_t uid, int connfd)
 #endif
     conn->input.ancillary_list = make_list();
     conn->output.ancillary_list = make_list();
-    action_1 socket_probe_cb = { conn, (act_1) socket_probe };
-    async_register(async, conn->fd, socket_probe_cb);
+    async_io_action socket_ready_cb = { conn, (async_io_act) socket_ready };
+    async_register_2(async, conn->fd, ASYNC_READABLE | ASYNC_WRITABLE,
+                     socket_ready_cb);
     conn->input.state = conn->output.state = CONNECTING;
     conn->flags = TCP_FLAG_EPOLL_SEND | TCP_FLAG_INGRESS_PENDING;
     return conn;
@@ -1227,6 +1263,51 @@ tcp_conn_t *tcp_adopt_connection(async_t *async, int connfd)
     return adopt_connection(async, uid, connfd);
 }
 
+FSTRACE_DECL(ASYNC_TCP_MIGRATE_RESUME, "UID=%64u ASYNC=%p");
+
+/* Performed in the target loop. */
+static void resume_migration(tcp_conn_t *conn)
+{
+    FSTRACE(ASYNC_TCP_MIGRATE_RESUME, conn->uid, conn->async);
+    conn->flags &= ~TCP_FLAG_MIGRATING;
+    async_io_action socket_ready_cb = { conn, (async_io_act) socket_ready };
+    async_register_2(conn->async, conn->fd, ASYNC_READABLE | ASYNC_WRITABLE,
+                     socket_ready_cb);
+    bytestream_1_register_callback(conn->output_stream,
+                                   (action_1) { conn, (act_1) user_probe });
+    /* Any readiness reported to the source loop has been lost. */
+    schedule_socket_probe(conn);
+    schedule_user_probe(conn);
+    action_1_perf(conn->migration_action);
+}
+
+FSTRACE_DECL(ASYNC_TCP_MIGRATE_HAND_OVER, "UID=%64u ASYNC=%p");
+
+/* Performed in the source loop after the probes that were scheduled
+ * before tcp_conn_migrate() was called. */
+static void hand_over(tcp_conn_t *conn)
+{
+    FSTRACE(ASYNC_TCP_MIGRATE_HAND_OVER, conn->uid, conn->migration_target);
+    conn->async = conn->migration_target;
+    async_execute_remote(conn->async,
+                         (action_1) { conn, (act_1) resume_migration });
+}
+
+FSTRACE_DECL(ASYNC_TCP_MIGRATE, "UID=%64u FROM=%p TO=%p OBJ=%p ACT=%p");
+
+void tcp_conn_migrate(tcp_conn_t *conn, async_t *target, action_1 action)
+{
+    FSTRACE(ASYNC_TCP_MIGRATE, conn->uid, conn->async, target, action.obj,
+            action.act);
+    assert(!conn->connection_closed && !(conn->flags & TCP_FLAG_MIGRATING));
+    conn->flags |= TCP_FLAG_MIGRATING;
+    conn->migration_target = target;
+    conn->migration_action = action;
+    async_unregister(conn->async, conn->fd);
+    bytestream_1_unregister_callback(conn->output_stream);
+    async_execute(conn->async, (action_1) { conn, (act_1) hand_over });
+}
+
 void tcp_get_statistics_1(tcp_conn_t *conn, tcp_statistics_1 *stats)
 {
     stats->bytes_received = conn->input.byte_count;
@@ -15,7 +15,7 @@ struct tricklestream {
     bytestream_1 stream;
     uint64_t due, interval;
     action_1 callback;
-    async_timer_t *retry_timer;
+    async_timer_t retry_timer;
 };
 
 FSTRACE_DECL(ASYNC_TRICKLESTREAM_RETRY, "UID=%64u");
@@ -25,7 +25,6 @@ static void retry(tricklestream_t *trickle)
     if (trickle->async == NULL)
         return;
     FSTRACE(ASYNC_TRICKLESTREAM_RETRY, trickle->uid);
-    trickle->retry_timer = NULL;
     action_1_perf(trickle->callback);
 }
 
@@ -35,17 +34,13 @@ static ssize_t do_read(tricklestream_t *trickle, void *buf, size_t count)
         return bytestream_1_read(trickle->stream, buf, count);
     if (count == 0)
         return 0;
-    if (trickle->retry_timer != NULL)
-        async_timer_cancel(trickle->async, trickle->retry_timer);
-    trickle->retry_timer = NULL;
-    uint64_t now = async_now(trickle->async);
+    uint64_t now = async_recent(trickle->async);
     if (now < trickle->due) {
-        trickle->retry_timer =
-            async_timer_start(trickle->async, trickle->due,
-                              (action_1) { trickle, (act_1) retry });
+        async_timer_rearm(trickle->async, &trickle->retry_timer, trickle->due);
         errno = EAGAIN;
         return -1;
     }
+    async_timer_stop(trickle->async, &trickle->retry_timer);
     ssize_t n = bytestream_1_read(trickle->stream, buf, 1);
     if (n > 0)
         trickle->due = now + trickle->interval; /* no point catching up */
@@ -75,8 +70,7 @@ void tricklestream_close(tricklestream_t *trickle)
     FSTRACE(ASYNC_TRICKLESTREAM_CLOSE, trickle->uid);
     assert(trickle->async != NULL);
     bytestream_1_close(trickle->stream);
-    if (trickle->retry_timer != NULL)
-        async_timer_cancel(trickle->async, trickle->retry_timer);
+    async_timer_stop(trickle->async, &trickle->retry_timer);
     async_wound(trickle->async, trickle);
     trickle->async = NULL;
 }
@@ -141,7 +135,8 @@ tricklestream_t *open_tricklestream(async_t *async, bytestream_1 stream,
     trickle->interval = (uint64_t)(ASYNC_S * interval);
     trickle->due = async_now(async) + trickle->interval;
     trickle->callback = NULL_ACTION_1;
-    trickle->retry_timer = NULL;
+    async_timer_init(&trickle->retry_timer,
+                     (action_1) { trickle, (act_1) retry });
     return trickle;
 }
 
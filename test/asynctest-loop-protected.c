@@ -65,3 +65,104 @@ VERDICT test_async_loop_protected(void)
     pthread_join(thread, NULL);
     return posttest_check(tester.base.verdict);
 }
+
+/* A FIFO lock, so that a thread waiting for the lock gets it as soon
+ * as the loop releases it. A plain mutex could let the loop barge
+ * ahead. */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t turn;
+    unsigned next, serving;
+} ticket_lock_t;
+
+static void ticket_lock(void *ptr)
+{
+    ticket_lock_t *lock = ptr;
+    pthread_mutex_lock(&lock->mutex);
+    unsigned ticket = lock->next++;
+    while (ticket != lock->serving)
+        pthread_cond_wait(&lock->turn, &lock->mutex);
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+static void ticket_unlock(void *ptr)
+{
+    ticket_lock_t *lock = ptr;
+    pthread_mutex_lock(&lock->mutex);
+    lock->serving++;
+    pthread_cond_broadcast(&lock->turn);
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+enum { SUBMISSIONS = 10 };
+
+typedef struct {
+    async_t *async;
+    ticket_lock_t lock;
+    uint64_t deadline;
+    int performed;
+} TEST_ASYNC_LOOP_PROTECTED_2;
+
+static void spin(TEST_ASYNC_LOOP_PROTECTED_2 *context)
+{
+    if (async_now(context->async) >= context->deadline) {
+        async_quit_loop(context->async);
+        return;
+    }
+    async_execute(context->async, (action_1) { context, (act_1) spin });
+}
+
+static void perform_submitted(TEST_ASYNC_LOOP_PROTECTED_2 *context)
+{
+    context->performed++;
+}
+
+static void *submitter_thread(void *arg)
+{
+    TEST_ASYNC_LOOP_PROTECTED_2 *context = arg;
+    int i;
+    for (i = 0; i < SUBMISSIONS; i++) {
+        ticket_lock(&context->lock);
+        async_execute(context->async,
+                      (action_1) { context, (act_1) perform_submitted });
+        ticket_unlock(&context->lock);
+        usleep(10000);
+    }
+    return NULL;
+}
+
+VERDICT test_async_loop_protected_2(void)
+{
+    TEST_ASYNC_LOOP_PROTECTED_2 context = {
+        .lock = {
+            .mutex = PTHREAD_MUTEX_INITIALIZER,
+            .turn = PTHREAD_COND_INITIALIZER,
+        },
+    };
+    async_t *async = context.async = make_async();
+    context.deadline = async_now(async) + 500 * ASYNC_MS;
+    async_execute(async, (action_1) { &context, (act_1) spin });
+    pthread_t thread;
+    ticket_lock(&context.lock);
+    pthread_create(&thread, NULL, submitter_thread, &context);
+    if (async_loop_protected_2(async, ticket_lock, ticket_unlock,
+                               &context.lock, ASYNC_MS) < 0)
+        tlog("Unexpected error from async_loop_protected_2: %d", errno);
+    ticket_unlock(&context.lock);
+    pthread_join(thread, NULL);
+    async_stats_t stats;
+    async_get_stats(async, &stats);
+    destroy_async(async);
+    if (context.performed != SUBMISSIONS) {
+        tlog("Only %d of %d tasks performed by the busy loop",
+             context.performed, SUBMISSIONS);
+        return FAIL;
+    }
+    if (!stats.unlocks_skipped || !stats.lock_releases) {
+        tlog("Unexpected lock statistics (skipped %llu, released %llu)",
+             (unsigned long long) stats.unlocks_skipped,
+             (unsigned long long) stats.lock_releases);
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
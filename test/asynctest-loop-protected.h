@@ -4,5 +4,6 @@
 #include "asynctest.h"
 
 VERDICT test_async_loop_protected(void);
+VERDICT test_async_loop_protected_2(void);
 
 #endif
@@ -0,0 +1,142 @@
+#include "asynctest-multiloop.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <async/multiloop.h>
+#include <async/tcp_connection.h>
+
+enum {
+    SHARD_COUNT = 4,
+    CONN_COUNT = 64,
+};
+
+typedef struct tester tester_t;
+
+typedef struct {
+    tester_t *tester;
+    tcp_server_t *server;
+    pthread_t thread;
+} shard_t;
+
+struct tester {
+    tester_base_t base;
+    shard_t shards[SHARD_COUNT];
+    unsigned started, accepted; /* updated by the shard threads */
+};
+
+static void accept_connections(shard_t *shard)
+{
+    tcp_conn_t *conn;
+    while ((conn = tcp_accept(shard->server, NULL, NULL)) != NULL) {
+        tcp_close_input_stream(conn);
+        tcp_close(conn);
+        __atomic_add_fetch(&shard->tester->accepted, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void start_shard(tester_t *tester, unsigned index, async_t *async,
+                        tcp_server_t *server)
+{
+    shard_t *shard = &tester->shards[index];
+    shard->tester = tester;
+    shard->server = server;
+    shard->thread = pthread_self();
+    action_1 accept_cb = { shard, (act_1) accept_connections };
+    tcp_register_server_callback(server, accept_cb);
+    async_execute(async, accept_cb);
+    __atomic_add_fetch(&tester->started, 1, __ATOMIC_RELEASE);
+}
+
+static void stop_shard(tester_t *tester, unsigned index, async_t *async)
+{
+    tcp_close_server(tester->shards[index].server);
+}
+
+static void check_progress(tester_t *tester)
+{
+    async_t *async = tester->base.async;
+    if (__atomic_load_n(&tester->accepted, __ATOMIC_ACQUIRE) < CONN_COUNT) {
+        async_timer_start(async, async_now(async) + 10 * ASYNC_MS,
+                          (action_1) { tester, (act_1) check_progress });
+        return;
+    }
+    if (__atomic_load_n(&tester->started, __ATOMIC_ACQUIRE) != SHARD_COUNT) {
+        tlog("Not all shards started");
+        quit_test(&tester->base);
+        return;
+    }
+    int i, j;
+    for (i = 0; i < SHARD_COUNT; i++)
+        for (j = 0; j < i; j++)
+            if (pthread_equal(tester->shards[i].thread,
+                              tester->shards[j].thread)) {
+                tlog("Shards %d and %d share a thread", j, i);
+                quit_test(&tester->base);
+                return;
+            }
+    tester->base.verdict = PASS;
+    quit_test(&tester->base);
+}
+
+VERDICT test_multiloop(void)
+{
+    async_t *async = make_async();
+    tester_t tester = { 0 };
+    init_test(&tester.base, async, 10);
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    unsigned flags = 0;
+#ifdef __linux__
+    flags = MULTILOOP_STEER_BY_CPU;
+#endif
+    multiloop_handler_t handler = {
+        .obj = &tester,
+        .start = (void *) start_shard,
+        .stop = (void *) stop_shard,
+    };
+    multiloop_t *multiloop =
+        make_multiloop((struct sockaddr *) &address, sizeof address,
+                       SHARD_COUNT, flags, handler);
+#ifdef __linux__
+    if (!multiloop && errno == EINVAL) {
+        /* Fewer CPUs than shards; steering is not possible. */
+        multiloop = make_multiloop((struct sockaddr *) &address,
+                                   sizeof address, SHARD_COUNT,
+                                   MULTILOOP_PIN_THREADS, handler);
+    }
+#endif
+    if (!multiloop) {
+        tlog("Unexpected error from make_multiloop: %d", errno);
+        return FAIL;
+    }
+    socklen_t addrlen;
+    const struct sockaddr *server_address =
+        multiloop_get_address(multiloop, &addrlen);
+    int clients[CONN_COUNT];
+    int i;
+    for (i = 0; i < CONN_COUNT; i++) {
+        clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(clients[i], server_address, addrlen) < 0) {
+            tlog("Unexpected error from connect: %d", errno);
+            close(clients[i]);
+            clients[i] = -1;
+        }
+    }
+    async_execute(async, (action_1) { &tester, (act_1) check_progress });
+    while (async_loop(async) < 0)
+        if (errno != EINTR) {
+            tlog("Unexpected error from async_loop: %d", errno);
+            break;
+        }
+    destroy_multiloop(multiloop);
+    for (i = 0; i < CONN_COUNT; i++)
+        if (clients[i] >= 0)
+            close(clients[i]);
+    destroy_async(async);
+    return posttest_check(tester.base.verdict);
+}
@@ -0,0 +1,8 @@
+#ifndef __ASYNCTEST_MULTILOOP__
+#define __ASYNCTEST_MULTILOOP__
+
+#include "asynctest.h"
+
+VERDICT test_multiloop(void);
+
+#endif
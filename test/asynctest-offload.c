@@ -0,0 +1,157 @@
+#include "asynctest-offload.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <async/async.h>
+
+enum { JOB_COUNT = 100 };
+
+typedef struct tester tester_t;
+
+typedef struct {
+    tester_t *tester;
+    int input, output;
+    pthread_t thread;
+} job_t;
+
+struct tester {
+    tester_base_t base;
+    job_t jobs[JOB_COUNT];
+    int completed;
+    pthread_t loop_thread;
+};
+
+static void work(job_t *job)
+{
+    job->thread = pthread_self();
+    usleep(1000);
+    job->output = job->input * job->input;
+}
+
+static void complete(job_t *job)
+{
+    tester_t *tester = job->tester;
+    if (pthread_equal(job->thread, tester->loop_thread) ||
+        job->output != job->input * job->input) {
+        tlog("Bad job %d", job->input);
+        quit_test(&tester->base);
+        return;
+    }
+    if (++tester->completed == JOB_COUNT) {
+        tester->base.verdict = PASS;
+        quit_test(&tester->base);
+    }
+}
+
+VERDICT test_async_offload(void)
+{
+    async_t *async = make_async();
+    tester_t tester = { .loop_thread = pthread_self() };
+    init_test(&tester.base, async, 5);
+    if (async_set_offload_threads(async, 3) < 0) {
+        tlog("Unexpected error from async_set_offload_threads: %d", errno);
+        return FAIL;
+    }
+    int i;
+    for (i = 0; i < JOB_COUNT; i++) {
+        job_t *job = &tester.jobs[i];
+        job->tester = &tester;
+        job->input = i;
+        if (async_offload(async, (void *) work, job,
+                          (action_1) { job, (act_1) complete }) < 0) {
+            tlog("Unexpected error from async_offload: %d", errno);
+            return FAIL;
+        }
+    }
+    if (async_set_offload_threads(async, 2) >= 0 || errno != EBUSY) {
+        tlog("Late async_set_offload_threads accepted");
+        return FAIL;
+    }
+    while (async_loop(async) < 0)
+        if (errno != EINTR) {
+            tlog("Unexpected error from async_loop: %d", errno);
+            break;
+        }
+    destroy_async(async);
+    return posttest_check(tester.base.verdict);
+}
+
+enum {
+    PRODUCER_COUNT = 4,
+    TASK_COUNT = 10000,
+};
+
+typedef struct remote_tester remote_tester_t;
+
+typedef struct {
+    remote_tester_t *tester;
+    int next; /* expected sequence number */
+    pthread_t thread;
+} producer_t;
+
+struct remote_tester {
+    tester_base_t base;
+    producer_t producers[PRODUCER_COUNT];
+    int performed;
+    bool out_of_order;
+};
+
+typedef struct {
+    producer_t *producer;
+    int seqno;
+} task_t;
+
+static void perform_task(task_t *task)
+{
+    producer_t *producer = task->producer;
+    remote_tester_t *tester = producer->tester;
+    if (task->seqno != producer->next++)
+        tester->out_of_order = true;
+    fsfree(task);
+    if (++tester->performed == PRODUCER_COUNT * TASK_COUNT) {
+        if (!tester->out_of_order)
+            tester->base.verdict = PASS;
+        quit_test(&tester->base);
+    }
+}
+
+static void *produce(void *arg)
+{
+    producer_t *producer = arg;
+    async_t *async = producer->tester->base.async;
+    int i;
+    for (i = 0; i < TASK_COUNT; i++) {
+        task_t *task = fsalloc(sizeof *task);
+        task->producer = producer;
+        task->seqno = i;
+        async_execute_remote(async, (action_1) { task, (act_1) perform_task });
+    }
+    return NULL;
+}
+
+VERDICT test_async_execute_remote(void)
+{
+    async_t *async = make_async();
+    remote_tester_t tester = { 0 };
+    init_test(&tester.base, async, 10);
+    int i;
+    for (i = 0; i < PRODUCER_COUNT; i++) {
+        producer_t *producer = &tester.producers[i];
+        producer->tester = &tester;
+        pthread_create(&producer->thread, NULL, produce, producer);
+    }
+    while (async_loop(async) < 0)
+        if (errno != EINTR) {
+            tlog("Unexpected error from async_loop: %d", errno);
+            break;
+        }
+    for (i = 0; i < PRODUCER_COUNT; i++)
+        pthread_join(tester.producers[i].thread, NULL);
+    destroy_async(async);
+    if (tester.out_of_order)
+        tlog("Tasks performed out of order");
+    return posttest_check(tester.base.verdict);
+}
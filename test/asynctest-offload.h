@@ -0,0 +1,9 @@
+#ifndef __ASYNCTEST_OFFLOAD__
+#define __ASYNCTEST_OFFLOAD__
+
+#include "asynctest.h"
+
+VERDICT test_async_execute_remote(void);
+VERDICT test_async_offload(void);
+
+#endif
@@ -149,3 +149,318 @@ VERDICT test_async_poll(void)
     destroy_async(async);
     return posttest_check(context.base.verdict);
 }
+
+typedef struct {
+    tester_base_t base;
+    int sd[2];
+    enum { EXPECT_INPUT, EXPECT_EOF } state;
+} readiness_tester_t;
+
+static void close_peer(readiness_tester_t *context)
+{
+    close(context->sd[1]);
+    context->sd[1] = -1;
+}
+
+static void ready(readiness_tester_t *context, unsigned readiness)
+{
+    if (!context->base.async)
+        return;
+    if (readiness & ASYNC_WRITABLE) {
+        tlog("Unsubscribed writability reported");
+        quit_test(&context->base);
+        return;
+    }
+    if (!(readiness & ASYNC_READABLE)) {
+        tlog("Readability not reported (readiness = 0x%x)", readiness);
+        quit_test(&context->base);
+        return;
+    }
+    uint8_t buffer[100];
+    ssize_t count = read(context->sd[0], buffer, sizeof buffer);
+    switch (context->state) {
+        case EXPECT_INPUT:
+            assert(count == 1);
+            context->state = EXPECT_EOF;
+            async_execute(context->base.async,
+                          (action_1) { context, (act_1) close_peer });
+            return;
+        case EXPECT_EOF:
+            if (count != 0) {
+                tlog("Read returned %d (errno = %d)", (int) count,
+                     (int) errno);
+                quit_test(&context->base);
+                return;
+            }
+            context->base.verdict = PASS;
+            quit_test(&context->base);
+            return;
+        default:
+            assert(false);
+    }
+}
+
+VERDICT test_async_register_2(void)
+{
+    async_t *async = make_async();
+    readiness_tester_t context = { .state = EXPECT_INPUT };
+    init_test(&context.base, async, 1);
+    int status = socketpair(AF_UNIX, SOCK_STREAM, 0, context.sd);
+    assert(status >= 0);
+    async_register_2(async, context.sd[0], ASYNC_READABLE,
+                     (async_io_action) { &context, (async_io_act) ready });
+    ssize_t count = write(context.sd[1], write, 1);
+    assert(count == 1);
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    async_unregister(async, context.sd[0]);
+    close(context.sd[0]);
+    if (context.sd[1] >= 0)
+        close(context.sd[1]);
+    destroy_async(async);
+    return posttest_check(context.base.verdict);
+}
+
+static void ignore_readiness(void *obj, unsigned readiness) {}
+
+VERDICT test_async_register_2_unregister(void)
+{
+    static const unsigned interests[] = {
+        ASYNC_READABLE, ASYNC_WRITABLE, ASYNC_READABLE | ASYNC_WRITABLE
+    };
+    async_t *async = make_async();
+    int sd[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sd) < 0) {
+        tlog("Failed to create a socket pair");
+        destroy_async(async);
+        return FAIL;
+    }
+    VERDICT verdict = PASS;
+    int i;
+    for (i = 0; i < sizeof interests / sizeof interests[0]; i++) {
+        async_io_action action = { NULL, ignore_readiness };
+        if (async_register_2(async, sd[0], interests[i], action) < 0) {
+            tlog("Failed to register with interest 0x%x (errno = %d)",
+                 interests[i], (int) errno);
+            verdict = FAIL;
+            break;
+        }
+        if (async_unregister(async, sd[0]) < 0) {
+            tlog("Failed to unregister with interest 0x%x (errno = %d)",
+                 interests[i], (int) errno);
+            verdict = FAIL;
+            break;
+        }
+    }
+    close(sd[0]);
+    close(sd[1]);
+    destroy_async(async);
+    return posttest_check(verdict);
+}
+
+typedef struct {
+    async_t *async;
+    int sd[2];
+    unsigned readiness;
+} TEST_ASYNC_URING;
+
+static void uring_ready(TEST_ASYNC_URING *context, unsigned readiness)
+{
+    context->readiness |= readiness;
+    async_quit_loop(context->async);
+}
+
+static VERDICT exercise_uring(TEST_ASYNC_URING *context)
+{
+    async_t *async = context->async;
+    async_io_action action = { context, (async_io_act) uring_ready };
+    if (async_register_2(async, context->sd[0], ASYNC_READABLE, action) < 0) {
+        tlog("Failed to register (errno = %d)", (int) errno);
+        return FAIL;
+    }
+    async_timer_start(async, async_now(async) + ASYNC_S,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (write(context->sd[1], "x", 1) != 1) {
+        tlog("Failed to write to the socket");
+        return FAIL;
+    }
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    if (context->readiness != ASYNC_READABLE) {
+        tlog("Unexpected readiness 0x%x", context->readiness);
+        return FAIL;
+    }
+    if (async_unregister(async, context->sd[0]) < 0) {
+        tlog("Failed to unregister (errno = %d)", (int) errno);
+        return FAIL;
+    }
+    return PASS;
+}
+
+VERDICT test_async_uring(void)
+{
+    TEST_ASYNC_URING context = { 0 };
+    async_t *async = context.async = make_async();
+    if (!async_uses_io_uring(async)) {
+        tlog("io_uring not in use; skipped");
+        destroy_async(async);
+        return posttest_check(PASS);
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, context.sd) < 0) {
+        tlog("Failed to create a socket pair");
+        destroy_async(async);
+        return FAIL;
+    }
+    VERDICT verdict = exercise_uring(&context);
+    close(context.sd[0]);
+    close(context.sd[1]);
+    destroy_async(async);
+    return posttest_check(verdict);
+}
+
+typedef struct {
+    async_t *async;
+    async_hook_t *prepare_hook, *check_hook;
+    int fd[2];
+    int prepared, checked, checked_before_read;
+} TEST_ASYNC_HOOKS;
+
+static void read_hooked(TEST_ASYNC_HOOKS *context)
+{
+    uint8_t byte;
+    if (read(context->fd[0], &byte, 1) == 1)
+        context->checked_before_read = context->checked;
+}
+
+static void prepare(TEST_ASYNC_HOOKS *context)
+{
+    if (++context->prepared == 1) {
+        ssize_t count = write(context->fd[1], "x", 1);
+        assert(count == 1);
+        return;
+    }
+    /* The loop must not block with the task pending. */
+    async_remove_hook(context->async, context->prepare_hook);
+    async_execute(context->async,
+                  (action_1) { context->async, (act_1) async_quit_loop });
+}
+
+static void check(TEST_ASYNC_HOOKS *context)
+{
+    context->checked++;
+}
+
+VERDICT test_async_hooks(void)
+{
+    TEST_ASYNC_HOOKS context = { 0 };
+    async_t *async = context.async = make_async();
+    if (pipe(context.fd) < 0) {
+        tlog("Failed to create a pipe");
+        destroy_async(async);
+        return FAIL;
+    }
+    async_register(async, context.fd[0],
+                   (action_1) { &context, (act_1) read_hooked });
+    context.prepare_hook =
+        async_add_prepare_hook(async, (action_1) { &context, (act_1) prepare });
+    context.check_hook =
+        async_add_check_hook(async, (action_1) { &context, (act_1) check });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    int checked_by_loop = context.checked_before_read;
+    int checked = context.checked;
+    context.checked_before_read = -1;
+    ssize_t count = write(context.fd[1], "x", 1);
+    assert(count == 1);
+    int i;
+    for (i = 0; i < 10 && context.checked_before_read < 0; i++) {
+        uint64_t timeout;
+        if (async_poll(async, &timeout) < 0)
+            tlog("Unexpected error from async_poll: %d", errno);
+    }
+    async_remove_hook(async, context.check_hook);
+    async_unregister(async, context.fd[0]);
+    close(context.fd[0]);
+    close(context.fd[1]);
+    destroy_async(async);
+    if (context.prepared != 2) {
+        tlog("Unexpected prepare count %d", context.prepared);
+        return FAIL;
+    }
+    if (checked_by_loop < 1) {
+        tlog("Check hook not called before the I/O callback");
+        return FAIL;
+    }
+    if (context.checked_before_read <= checked) {
+        tlog("Check hook not called by async_poll()");
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+typedef struct {
+    int fd[2];
+    int *reads;
+} TEST_ASYNC_POLL_N_PIPE;
+
+static void read_pipe(TEST_ASYNC_POLL_N_PIPE *pipe_)
+{
+    uint8_t byte;
+    if (read(pipe_->fd[0], &byte, 1) == 1)
+        (*pipe_->reads)++;
+}
+
+static void count_task(int *tasks)
+{
+    (*tasks)++;
+}
+
+VERDICT test_async_poll_n(void)
+{
+    enum { PIPES = 8, TASKS = 20, MAX = 10 };
+    async_t *async = make_async();
+    TEST_ASYNC_POLL_N_PIPE pipes[PIPES];
+    int reads = 0, tasks = 0;
+    int i;
+    for (i = 0; i < PIPES; i++) {
+        if (pipe(pipes[i].fd) < 0) {
+            tlog("Failed to create a pipe");
+            destroy_async(async);
+            return FAIL;
+        }
+        pipes[i].reads = &reads;
+        async_register(async, pipes[i].fd[0],
+                       (action_1) { &pipes[i], (act_1) read_pipe });
+        if (write(pipes[i].fd[1], "x", 1) != 1) {
+            tlog("Failed to write to a pipe");
+            destroy_async(async);
+            return FAIL;
+        }
+    }
+    for (i = 0; i < TASKS; i++)
+        async_execute(async, (action_1) { &tasks, (act_1) count_task });
+    VERDICT verdict = PASS;
+    uint64_t timeout;
+    int count = async_poll_n(async, MAX, -1, &timeout);
+    if (count != MAX || tasks != MAX || timeout != 0) {
+        tlog("First poll: count = %d, tasks = %d", count, tasks);
+        verdict = FAIL;
+    }
+    count = async_poll_n(async, 100, -1, &timeout);
+    if (count != TASKS - MAX + PIPES || tasks != TASKS || reads != PIPES) {
+        tlog("Second poll: count = %d, tasks = %d, reads = %d", count,
+             tasks, reads);
+        verdict = FAIL;
+    }
+    if (timeout != (uint64_t) -1) {
+        tlog("Unexpected timeout %llu", (unsigned long long) timeout);
+        verdict = FAIL;
+    }
+    for (i = 0; i < PIPES; i++) {
+        async_unregister(async, pipes[i].fd[0]);
+        close(pipes[i].fd[0]);
+        close(pipes[i].fd[1]);
+    }
+    destroy_async(async);
+    return posttest_check(verdict);
+}
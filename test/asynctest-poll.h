@@ -4,6 +4,11 @@
 #include "asynctest.h"
 
 VERDICT test_async_register(void);
+VERDICT test_async_register_2(void);
+VERDICT test_async_register_2_unregister(void);
+VERDICT test_async_uring(void);
 VERDICT test_async_poll(void);
+VERDICT test_async_poll_n(void);
+VERDICT test_async_hooks(void);
 
 #endif
@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/un.h>
@@ -367,3 +368,133 @@ VERDICT test_tcp_connection(void)
     destroy_async(async);
     return posttest_check(context.verdict);
 }
+
+static const char migrate_message[] = "hello";
+
+typedef struct {
+    tester_base_t base;
+    tcp_server_t *server;
+    tcp_conn_t *sconn;
+    async_t *worker;
+    pthread_t worker_thread, client_thread;
+    struct sockaddr_un addr;
+    bool migrated_in_worker;
+    char echo[100];
+    ssize_t echo_length;
+} migrate_tester_t;
+
+static void *run_worker(void *arg)
+{
+    migrate_tester_t *tester = arg;
+    while (async_loop(tester->worker) < 0)
+        if (errno != EINTR) {
+            tlog("Unexpected error from async_loop: %d", errno);
+            break;
+        }
+    return NULL;
+}
+
+static void finish_migrate_test(migrate_tester_t *tester)
+{
+    if (!tester->migrated_in_worker)
+        tlog("Migration not completed in the worker thread");
+    else if (tester->echo_length != strlen(migrate_message) ||
+             memcmp(tester->echo, migrate_message, tester->echo_length))
+        tlog("Bad echo");
+    else
+        tester->base.verdict = PASS;
+    quit_test(&tester->base);
+}
+
+/* A blocking client that sends a message before the connection is
+ * migrated and expects it back from the worker. */
+static void *run_client(void *arg)
+{
+    migrate_tester_t *tester = arg;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr *addr = (struct sockaddr *) &tester->addr;
+    if (connect(fd, addr, sizeof tester->addr) < 0 ||
+        write(fd, migrate_message, strlen(migrate_message)) < 0)
+        tlog("Unexpected error from client: %d", errno);
+    else {
+        shutdown(fd, SHUT_WR);
+        ssize_t count;
+        while ((count = read(fd, tester->echo + tester->echo_length,
+                             sizeof tester->echo - tester->echo_length)) > 0)
+            tester->echo_length += count;
+    }
+    close(fd);
+    async_execute_remote(tester->base.async,
+                         (action_1) { tester, (act_1) finish_migrate_test });
+    return NULL;
+}
+
+static void close_migrated(migrate_tester_t *tester)
+{
+    tcp_close(tester->sconn);
+}
+
+/* Performed in the worker loop. */
+static void migrated(migrate_tester_t *tester)
+{
+    tester->migrated_in_worker =
+        pthread_equal(pthread_self(), tester->worker_thread);
+    farewellstream_t *echo =
+        open_farewellstream(tester->worker,
+                            tcp_get_input_stream(tester->sconn),
+                            (action_1) { tester, (act_1) close_migrated });
+    tcp_set_output_stream(tester->sconn, farewellstream_as_bytestream_1(echo));
+}
+
+static void accept_and_migrate(migrate_tester_t *tester)
+{
+    if (tester->sconn)
+        return;
+    tester->sconn = tcp_accept(tester->server, NULL, NULL);
+    if (tester->sconn)
+        tcp_conn_migrate(tester->sconn, tester->worker,
+                         (action_1) { tester, (act_1) migrated });
+}
+
+static void quit_worker(migrate_tester_t *tester)
+{
+    async_quit_loop(tester->worker);
+}
+
+VERDICT test_tcp_conn_migrate(void)
+{
+    async_t *async = make_async();
+    migrate_tester_t tester = {
+        .addr = { .sun_family = AF_UNIX },
+    };
+    init_test(&tester.base, async, 10);
+    const char *sockpath = "/tmp/asynctest-migrate.sock";
+    (void) unlink(sockpath);
+    strcpy(tester.addr.sun_path, sockpath);
+    tester.server = tcp_listen(async, (struct sockaddr *) &tester.addr,
+                               sizeof tester.addr);
+    if (tester.server == NULL) {
+        tlog("Unexpected error (errno %d) from tcp_listen", (int) errno);
+        return FAIL;
+    }
+    action_1 accept_cb = { &tester, (act_1) accept_and_migrate };
+    tcp_register_server_callback(tester.server, accept_cb);
+    async_execute(async, accept_cb);
+    tester.worker = make_async();
+    pthread_create(&tester.worker_thread, NULL, run_worker, &tester);
+    pthread_create(&tester.client_thread, NULL, run_client, &tester);
+    while (async_loop(async) < 0)
+        if (errno != EINTR) {
+            tlog("Unexpected error from async_loop: %d", errno);
+            break;
+        }
+    pthread_join(tester.client_thread, NULL);
+    async_execute_remote(tester.worker,
+                         (action_1) { &tester, (act_1) quit_worker });
+    pthread_join(tester.worker_thread, NULL);
+    destroy_async(tester.worker);
+    (void) unlink(sockpath);
+    tcp_close_server(tester.server);
+    destroy_async(async);
+    return posttest_check(tester.base.verdict);
+}
@@ -4,5 +4,6 @@
 #include "asynctest.h"
 
 VERDICT test_tcp_connection(void);
+VERDICT test_tcp_conn_migrate(void);
 
 #endif
@@ -4,8 +4,10 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include <async/async.h>
+#include <fsdyn/fsalloc.h>
 
 static uint64_t nanoseconds(void)
 {
@@ -74,3 +76,584 @@ VERDICT test_async_timer_cancel(void)
     }
     return posttest_check(PASS);
 }
+
+typedef struct {
+    async_t *async;
+    async_once_t once, canceled;
+    int count;
+    bool canceled_performed;
+} TEST_ASYNC_EXECUTE_ONCE;
+
+static void count_it(TEST_ASYNC_EXECUTE_ONCE *context)
+{
+    /* A call made during the performance schedules the action anew. */
+    if (++context->count == 1)
+        async_execute_once(context->async, &context->once,
+                           (action_1) { context, (act_1) count_it });
+}
+
+static void flag_it(TEST_ASYNC_EXECUTE_ONCE *context)
+{
+    context->canceled_performed = true;
+}
+
+VERDICT test_async_execute_once(void)
+{
+    enum { TRIGGERS = 1000 };
+    TEST_ASYNC_EXECUTE_ONCE context = { 0 };
+    async_t *async = context.async = make_async();
+    async_once_init(&context.once);
+    async_once_init(&context.canceled);
+    int i;
+    for (i = 0; i < TRIGGERS; i++)
+        async_execute_once(async, &context.once,
+                           (action_1) { &context, (act_1) count_it });
+    async_execute_once(async, &context.canceled,
+                       (action_1) { &context, (act_1) flag_it });
+    async_once_cancel(async, &context.canceled);
+    async_timer_start(async, async_now(async) + 100 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    destroy_async(async);
+    if (context.count != 2) {
+        tlog("Unexpected performance count %d", context.count);
+        return FAIL;
+    }
+    if (context.canceled_performed) {
+        tlog("Canceled action performed");
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+typedef struct {
+    async_t *async;
+    async_timer_t oneshot, stopped, periodic;
+    int oneshot_count, stopped_count, periodic_count;
+    uint64_t oneshot_time;
+    bool disarmed_in_action;
+} TEST_ASYNC_TIMER_REARM;
+
+static void oneshot_fired(TEST_ASYNC_TIMER_REARM *context)
+{
+    context->oneshot_count++;
+    context->oneshot_time = async_now(context->async);
+}
+
+static void stopped_fired(TEST_ASYNC_TIMER_REARM *context)
+{
+    context->stopped_count++;
+}
+
+static void periodic_fired(TEST_ASYNC_TIMER_REARM *context)
+{
+    if (!async_timer_armed(&context->periodic))
+        context->disarmed_in_action = true;
+    if (++context->periodic_count == 5) {
+        async_timer_stop(context->async, &context->periodic);
+        async_quit_loop(context->async);
+    }
+}
+
+VERDICT test_async_timer_rearm(void)
+{
+    TEST_ASYNC_TIMER_REARM context = { 0 };
+    async_t *async = context.async = make_async();
+    async_timer_init(&context.oneshot,
+                     (action_1) { &context, (act_1) oneshot_fired });
+    async_timer_init(&context.stopped,
+                     (action_1) { &context, (act_1) stopped_fired });
+    async_timer_init(&context.periodic,
+                     (action_1) { &context, (act_1) periodic_fired });
+    uint64_t t0 = async_now(async);
+    async_timer_rearm(async, &context.oneshot, t0 + 10 * ASYNC_MS);
+    async_timer_rearm(async, &context.oneshot, t0 + 5 * ASYNC_S);
+    async_timer_rearm(async, &context.oneshot, t0 + 20 * ASYNC_MS);
+    async_timer_rearm(async, &context.stopped, t0 + 10 * ASYNC_MS);
+    async_timer_stop(async, &context.stopped);
+    async_timer_stop(async, &context.stopped);
+    async_timer_rearm_periodic(async, &context.periodic, t0 + 10 * ASYNC_MS,
+                               20 * ASYNC_MS);
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    uint64_t t1 = async_now(async);
+    bool armed = async_timer_armed(&context.oneshot) ||
+        async_timer_armed(&context.stopped) ||
+        async_timer_armed(&context.periodic);
+    destroy_async(async);
+    if (context.oneshot_count != 1 || context.stopped_count != 0 ||
+        context.periodic_count != 5 || context.disarmed_in_action ||
+        armed) {
+        tlog("Unexpected counts %d, %d, %d", context.oneshot_count,
+             context.stopped_count, context.periodic_count);
+        return FAIL;
+    }
+    if (context.oneshot_time < t0 + 20 * ASYNC_MS ||
+        context.oneshot_time >= t0 + ASYNC_S) {
+        tlog("Rearmed timer fired at the wrong time");
+        return FAIL;
+    }
+    if (t1 - t0 < 90 * ASYNC_MS || t1 - t0 >= ASYNC_S) {
+        tlog("Unexpected periodic timer duration");
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+typedef struct {
+    async_t *async;
+    async_timer_t persistent;
+    uint64_t started_at, persistent_at;
+} TEST_ASYNC_TIMER_SLACK;
+
+static void started_fired(TEST_ASYNC_TIMER_SLACK *context)
+{
+    context->started_at = async_now(context->async);
+}
+
+static void persistent_fired(TEST_ASYNC_TIMER_SLACK *context)
+{
+    context->persistent_at = async_now(context->async);
+}
+
+VERDICT test_async_timer_slack(void)
+{
+    TEST_ASYNC_TIMER_SLACK context = { 0 };
+    async_t *async = context.async = make_async();
+    uint64_t t0 = async_now(async);
+    uint64_t expires = t0 + 20 * ASYNC_MS, slack = 30 * ASYNC_MS;
+    async_timer_start_slack(async, expires, slack,
+                            (action_1) { &context, (act_1) started_fired });
+    async_timer_init(&context.persistent,
+                     (action_1) { &context, (act_1) persistent_fired });
+    async_timer_rearm_slack(async, &context.persistent, expires, slack);
+    async_timer_start(async, t0 + 200 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    destroy_async(async);
+    /* Allow for some scheduling delay past the window. */
+    uint64_t deadline = expires + slack + 50 * ASYNC_MS;
+    if (context.started_at < expires || context.started_at > deadline ||
+        context.persistent_at < expires || context.persistent_at > deadline) {
+        tlog("Timer fired outside its window");
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+typedef struct TEST_ASYNC_PRIO TEST_ASYNC_PRIO;
+
+typedef struct {
+    TEST_ASYNC_PRIO *context;
+    async_prio_t prio;
+    int index;
+} TEST_ASYNC_PRIO_TASK;
+
+struct TEST_ASYNC_PRIO {
+    TEST_ASYNC_PRIO_TASK *log[300];
+    int count;
+};
+
+static void log_prio(TEST_ASYNC_PRIO_TASK *task)
+{
+    task->context->log[task->context->count++] = task;
+}
+
+VERDICT test_async_execute_prio(void)
+{
+    enum { TASKS = 100 };
+    static const async_prio_t order[] = {
+        ASYNC_PRIO_LOW, ASYNC_PRIO_NORMAL, ASYNC_PRIO_HIGH
+    };
+    TEST_ASYNC_PRIO context = { .count = 0 };
+    TEST_ASYNC_PRIO_TASK tasks[3][TASKS];
+    async_t *async = make_async();
+    int i, j;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < TASKS; j++) {
+            TEST_ASYNC_PRIO_TASK *task = &tasks[i][j];
+            task->context = &context;
+            task->prio = order[i];
+            task->index = j;
+            async_execute_prio(async, order[i],
+                               (action_1) { task, (act_1) log_prio });
+        }
+    async_timer_start(async, async_now(async) + 100 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    destroy_async(async);
+    if (context.count != 3 * TASKS) {
+        tlog("Unexpected task count %d", context.count);
+        return FAIL;
+    }
+    int next[ASYNC_PRIO_LEVELS] = { 0 };
+    int first_low = -1;
+    for (i = 0; i < context.count; i++) {
+        TEST_ASYNC_PRIO_TASK *task = context.log[i];
+        if (task->index != next[task->prio]++) {
+            tlog("FIFO order violated at %d", i);
+            return FAIL;
+        }
+        if (task->prio == ASYNC_PRIO_LOW && first_low < 0)
+            first_low = i;
+    }
+    for (i = 0; i < ASYNC_PRIO_STARVATION_LIMIT; i++)
+        if (context.log[i]->prio != ASYNC_PRIO_HIGH) {
+            tlog("High-priority task passed over at %d", i);
+            return FAIL;
+        }
+    if (first_low > 3 * ASYNC_PRIO_STARVATION_LIMIT) {
+        tlog("Low-priority task starved until %d", first_low);
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+typedef struct {
+    int *count;
+    unsigned magic;
+} TEST_ASYNC_WOUND_OBJ;
+
+enum { WOUND_MAGIC = 0x600d0b1 };
+
+static void probe_wounded(TEST_ASYNC_WOUND_OBJ *obj)
+{
+    if (obj->magic == WOUND_MAGIC)
+        (*obj->count)++;
+}
+
+static async_t *wound_async;
+
+static void wound_obj(TEST_ASYNC_WOUND_OBJ *obj)
+{
+    async_execute_prio(wound_async, ASYNC_PRIO_LOW,
+                       (action_1) { obj, (act_1) probe_wounded });
+    async_wound(wound_async, obj);
+}
+
+VERDICT test_async_wound(void)
+{
+    enum { OBJECTS = 1000 };
+    int count = 0;
+    async_t *async = wound_async = make_async();
+    int i;
+    for (i = 0; i < OBJECTS; i++) {
+        TEST_ASYNC_WOUND_OBJ *obj = fsalloc(sizeof *obj);
+        obj->count = &count;
+        obj->magic = WOUND_MAGIC;
+        if (i % 2)
+            wound_obj(obj);
+        else
+            async_execute(async, (action_1) { obj, (act_1) wound_obj });
+    }
+    async_timer_start(async, async_now(async) + 100 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    destroy_async(async);
+    if (count != OBJECTS) {
+        tlog("Wounded object freed prematurely (%d probes)", count);
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+static void count_event(int *count)
+{
+    (*count)++;
+}
+
+VERDICT test_async_event(void)
+{
+    async_t *async = make_async();
+    int coalesced = 0, canceled = 0, retriggered = 0, destroyed = 0;
+    async_event_t *event =
+        make_async_event(async, (action_1) { &coalesced, (act_1) count_event });
+    async_event_trigger(event);
+    async_event_trigger(event);
+    async_event_trigger(event);
+    async_event_t *canceled_event =
+        make_async_event(async, (action_1) { &canceled, (act_1) count_event });
+    async_event_trigger(canceled_event);
+    async_event_cancel(canceled_event);
+    async_event_t *retriggered_event =
+        make_async_event(async,
+                         (action_1) { &retriggered, (act_1) count_event });
+    async_event_trigger(retriggered_event);
+    async_event_cancel(retriggered_event);
+    async_event_trigger(retriggered_event);
+    async_event_t *destroyed_event =
+        make_async_event(async, (action_1) { &destroyed, (act_1) count_event });
+    async_event_trigger(destroyed_event);
+    destroy_async_event(destroyed_event);
+    async_timer_start(async, async_now(async) + 100 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    /* An event can be triggered again after its callback. */
+    async_event_trigger(event);
+    async_timer_start(async, async_now(async) + 10 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0)
+        tlog("Unexpected error from async_loop: %d", errno);
+    destroy_async_event(event);
+    destroy_async_event(canceled_event);
+    destroy_async_event(retriggered_event);
+    destroy_async(async);
+    if (coalesced != 2 || canceled != 0 || retriggered != 1 ||
+        destroyed != 0) {
+        tlog("Unexpected callback counts %d, %d, %d, %d", coalesced,
+             canceled, retriggered, destroyed);
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+static uint64_t histogram_total(const async_histogram_t *histogram)
+{
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < ASYNC_STATS_BUCKETS; i++)
+        total += histogram->bucket[i];
+    return total;
+}
+
+static void do_nothing(void *obj) {}
+
+VERDICT test_async_stats(void)
+{
+    enum { TASKS = 5 };
+    async_t *async = make_async();
+    int i;
+    for (i = 0; i < TASKS; i++)
+        async_execute(async, (action_1) { NULL, do_nothing });
+    async_timer_start(async, async_now(async) + 100 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0) {
+        tlog("Unexpected error from async_loop: %d", errno);
+        destroy_async(async);
+        return FAIL;
+    }
+    async_stats_t stats;
+    async_get_stats(async, &stats);
+    destroy_async(async);
+    if (stats.callbacks != TASKS + 1) {
+        tlog("Unexpected callback count %llu",
+             (unsigned long long) stats.callbacks);
+        return FAIL;
+    }
+    if (histogram_total(&stats.timer_lateness) != 1) {
+        tlog("Timer lateness not recorded");
+        return FAIL;
+    }
+    if (stats.iterations < 2 ||
+        histogram_total(&stats.immediate_depth) != stats.iterations ||
+        histogram_total(&stats.iteration_callbacks) != stats.iterations) {
+        tlog("Inconsistent iteration statistics");
+        return FAIL;
+    }
+    if (stats.immediate_depth.bucket[0] == stats.iterations) {
+        tlog("Immediate depth not recorded");
+        return FAIL;
+    }
+    if (stats.io_waits == 0 ||
+        histogram_total(&stats.io_batch) != stats.io_waits) {
+        tlog("Inconsistent I/O statistics");
+        return FAIL;
+    }
+    if (stats.blocked_ns < 50 * ASYNC_MS ||
+        stats.blocked_ns + stats.busy_ns > 200 * ASYNC_MS) {
+        tlog("Unexpected blocked time %llu ns",
+             (unsigned long long) stats.blocked_ns);
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+VERDICT test_async_policy(void)
+{
+    enum { TASKS = 5 };
+    async_t *async = make_async();
+    async_policy_t policy;
+    async_get_policy(async, &policy);
+    if (policy.io_burst != ASYNC_DEFAULT_IO_BURST ||
+        policy.callback_budget != ASYNC_DEFAULT_CALLBACK_BUDGET ||
+        policy.adaptive) {
+        tlog("Unexpected default policy");
+        destroy_async(async);
+        return FAIL;
+    }
+    async_policy_t bad = { .io_burst = 0, .callback_budget = 1 };
+    if (async_set_policy(async, &bad) >= 0 || errno != EINVAL) {
+        tlog("Zero I/O burst accepted");
+        destroy_async(async);
+        return FAIL;
+    }
+    bad = (async_policy_t) {
+        .io_burst = 8, .callback_budget = 1, .adaptive = true,
+        .max_io_burst = 4
+    };
+    if (async_set_policy(async, &bad) >= 0 || errno != EINVAL) {
+        tlog("Inverted adaptive range accepted");
+        destroy_async(async);
+        return FAIL;
+    }
+    policy = (async_policy_t) {
+        .io_burst = 1, .callback_budget = 1, .adaptive = true,
+        .max_io_burst = 64
+    };
+    if (async_set_policy(async, &policy) < 0) {
+        tlog("Unexpected error from async_set_policy: %d", errno);
+        destroy_async(async);
+        return FAIL;
+    }
+    int i;
+    for (i = 0; i < TASKS; i++)
+        async_execute(async, (action_1) { NULL, do_nothing });
+    async_timer_start(async, async_now(async) + 100 * ASYNC_MS,
+                      (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0) {
+        tlog("Unexpected error from async_loop: %d", errno);
+        destroy_async(async);
+        return FAIL;
+    }
+    async_stats_t stats;
+    async_get_stats(async, &stats);
+    destroy_async(async);
+    /* With a budget of one, each task gets an iteration of its own. */
+    if (stats.callbacks != TASKS + 1 || stats.iterations < TASKS + 1) {
+        tlog("Callback budget not honored");
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+/* The bodies differ so that the linker cannot fold the two functions
+ * into one. */
+static void profiled_once(int *counter)
+{
+    *counter += 10;
+}
+
+static void profiled_twice(int *counter)
+{
+    ++*counter;
+}
+
+VERDICT test_async_profile(void)
+{
+    async_t *async = make_async();
+    async_set_profiling(async, 1);
+    int once = 0, twice = 0;
+    async_execute(async, (action_1) { &twice, (act_1) profiled_twice });
+    async_execute(async, (action_1) { &once, (act_1) profiled_once });
+    async_execute(async, (action_1) { &twice, (act_1) profiled_twice });
+    async_execute(async, (action_1) { async, (act_1) async_quit_loop });
+    if (async_loop(async) < 0) {
+        tlog("Unexpected error from async_loop: %d", errno);
+        destroy_async(async);
+        return FAIL;
+    }
+    if (once != 10 || twice != 2) {
+        tlog("Unexpected side effects %d, %d", once, twice);
+        destroy_async(async);
+        return FAIL;
+    }
+    FILE *f = tmpfile();
+    async_dump_profile(async, f);
+    destroy_async(async);
+    rewind(f);
+    char line[1000];
+    int lines = 0;
+    unsigned long long count, total_ns, max_ns;
+    void *act;
+    bool twice_seen = false;
+    while (fgets(line, sizeof line, f)) {
+        if (lines++ == 0)
+            continue;
+        if (sscanf(line, "%llu %llu %llu %p", &count, &total_ns, &max_ns,
+                   &act) != 4 ||
+            max_ns > total_ns) {
+            tlog("Bad profile line: %s", line);
+            fclose(f);
+            return FAIL;
+        }
+        if (act == (void *) profiled_twice) {
+            if (count != 2) {
+                tlog("Unexpected profile count %llu", count);
+                fclose(f);
+                return FAIL;
+            }
+            twice_seen = true;
+        }
+    }
+    fclose(f);
+    if (lines != 4 || !twice_seen) {
+        tlog("Unexpected profile");
+        return FAIL;
+    }
+    return posttest_check(PASS);
+}
+
+typedef struct {
+    async_t *async;
+    int stalls;
+    void *act;
+    int backtrace_depth;
+} TEST_ASYNC_WATCHDOG;
+
+static void stall_loop(TEST_ASYNC_WATCHDOG *context)
+{
+    struct timespec t = { .tv_nsec = 300000000 };
+    while (nanosleep(&t, &t) < 0 && errno == EINTR)
+        ;
+    /* Keep waiting for I/O for a while in case SIGURG arrives late. */
+    async_timer_start(context->async,
+                      async_now(context->async) + 100 * ASYNC_MS,
+                      (action_1) { context->async, (act_1) async_quit_loop });
+}
+
+static void report_stall(TEST_ASYNC_WATCHDOG *context,
+                         const async_stall_t *stall)
+{
+    context->stalls++;
+    context->act = stall->act;
+    context->backtrace_depth = stall->backtrace_depth;
+}
+
+VERDICT test_async_watchdog(void)
+{
+    TEST_ASYNC_WATCHDOG context = { 0 };
+    async_t *async = context.async = make_async();
+    async_stall_action sink = {
+        &context, (async_stall_act) report_stall
+    };
+    if (async_start_watchdog(async, 100 * ASYNC_MS, sink) < 0) {
+        tlog("Unexpected error from async_start_watchdog: %d", errno);
+        destroy_async(async);
+        return FAIL;
+    }
+    async_execute(async, (action_1) { NULL, do_nothing });
+    async_execute(async, (action_1) { &context, (act_1) stall_loop });
+    if (async_loop(async) < 0) {
+        tlog("Unexpected error from async_loop: %d", errno);
+        destroy_async(async);
+        return FAIL;
+    }
+    async_stop_watchdog(async);
+    destroy_async(async);
+    if (context.stalls != 1 || context.act != (void *) stall_loop) {
+        tlog("Stall not reported");
+        return FAIL;
+    }
+#ifdef HAVE_EXECINFO
+    if (context.backtrace_depth == 0) {
+        tlog("No backtrace");
+        return FAIL;
+    }
+#endif
+    return posttest_check(PASS);
+}
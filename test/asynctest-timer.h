@@ -5,5 +5,15 @@
 
 VERDICT test_async_timer_start(void);
 VERDICT test_async_timer_cancel(void);
+VERDICT test_async_timer_rearm(void);
+VERDICT test_async_timer_slack(void);
+VERDICT test_async_execute_once(void);
+VERDICT test_async_execute_prio(void);
+VERDICT test_async_wound(void);
+VERDICT test_async_event(void);
+VERDICT test_async_stats(void);
+VERDICT test_async_policy(void);
+VERDICT test_async_profile(void);
+VERDICT test_async_watchdog(void);
 
 #endif
@@ -29,8 +29,10 @@
 #include "asynctest-jsonserver.h"
 #include "asynctest-jsonthreader.h"
 #include "asynctest-loop-protected.h"
+#include "asynctest-multiloop.h"
 #include "asynctest-multipart.h"
 #include "asynctest-nicestream.h"
+#include "asynctest-offload.h"
 #include "asynctest-old-school.h"
 #include "asynctest-pacerstream.h"
 #include "asynctest-pausestream.h"
@@ -189,8 +191,23 @@ typedef struct {
 static const testcase_t testcases[] = {
     TESTCASE(test_async_timer_start),
     TESTCASE(test_async_timer_cancel),
+    TESTCASE(test_async_timer_rearm),
+    TESTCASE(test_async_timer_slack),
+    TESTCASE(test_async_execute_once),
+    TESTCASE(test_async_execute_prio),
+    TESTCASE(test_async_wound),
+    TESTCASE(test_async_event),
+    TESTCASE(test_async_stats),
+    TESTCASE(test_async_policy),
+    TESTCASE(test_async_profile),
+    TESTCASE(test_async_watchdog),
     TESTCASE(test_async_register),
+    TESTCASE(test_async_register_2),
+    TESTCASE(test_async_register_2_unregister),
+    TESTCASE(test_async_uring),
     TESTCASE(test_async_poll),
+    TESTCASE(test_async_poll_n),
+    TESTCASE(test_async_hooks),
     TESTCASE(test_async_old_school),
     TESTCASE(test_zerostream),
     TESTCASE(test_nicestream),
@@ -226,6 +243,11 @@ static const testcase_t testcases[] = {
 
 static const testcase_t mt_testcases[] = {
     TESTCASE(test_async_loop_protected),
+    TESTCASE(test_async_loop_protected_2),
+    TESTCASE(test_async_execute_remote),
+    TESTCASE(test_async_offload),
+    TESTCASE(test_multiloop),
+    TESTCASE(test_tcp_conn_migrate),
 };
 
 static fstrace_t *trace;
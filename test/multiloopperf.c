@@ -0,0 +1,169 @@
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <async/async.h>
+#include <async/farewellstream.h>
+#include <async/multiloop.h>
+#include <async/tcp_connection.h>
+
+/* A loopback echo service is run with 1, 2, 4, ... loops. A fixed
+ * population of client threads ping-pong small messages over their own
+ * connections for a while. Report round trips per second. */
+
+enum {
+    CLIENTS_PER_LOOP = 4,
+    MESSAGE_SIZE = 64,
+    DURATION_S = 3,
+};
+
+typedef struct {
+    async_t *async;
+    tcp_server_t *server;
+} shard_t;
+
+typedef struct {
+    const struct sockaddr *address;
+    socklen_t addrlen;
+    bool stop;
+    uint64_t round_trips;
+    pthread_t thread;
+} client_t;
+
+static void accept_connections(shard_t *shard)
+{
+    tcp_conn_t *conn;
+    while ((conn = tcp_accept(shard->server, NULL, NULL)) != NULL) {
+        int on = 1;
+        setsockopt(tcp_get_fd(conn), IPPROTO_TCP, TCP_NODELAY, &on,
+                   sizeof on);
+        farewellstream_t *echo =
+            open_farewellstream(shard->async, tcp_get_input_stream(conn),
+                                (action_1) { conn, (act_1) tcp_close });
+        tcp_set_output_stream(conn, farewellstream_as_bytestream_1(echo));
+    }
+}
+
+static void start_shard(shard_t *shards, unsigned index, async_t *async,
+                        tcp_server_t *server)
+{
+    shard_t *shard = &shards[index];
+    shard->async = async;
+    shard->server = server;
+    action_1 accept_cb = { shard, (act_1) accept_connections };
+    tcp_register_server_callback(server, accept_cb);
+    async_execute(async, accept_cb);
+}
+
+static void stop_shard(shard_t *shards, unsigned index, async_t *async)
+{
+    tcp_close_server(shards[index].server);
+}
+
+static bool transfer(int fd, char *buf, bool sending)
+{
+    size_t done = 0;
+    while (done < MESSAGE_SIZE) {
+        ssize_t n = sending ? write(fd, buf + done, MESSAGE_SIZE - done)
+                            : read(fd, buf + done, MESSAGE_SIZE - done);
+        if (n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static void *run_client(void *arg)
+{
+    client_t *client = arg;
+    int fd = socket(client->address->sa_family, SOCK_STREAM, 0);
+    if (connect(fd, client->address, client->addrlen) < 0) {
+        perror("multiloopperf: connect");
+        exit(EXIT_FAILURE);
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof on);
+    char buf[MESSAGE_SIZE] = { 0 };
+    while (!__atomic_load_n(&client->stop, __ATOMIC_RELAXED)) {
+        if (!transfer(fd, buf, true) || !transfer(fd, buf, false)) {
+            perror("multiloopperf: echo");
+            exit(EXIT_FAILURE);
+        }
+        client->round_trips++;
+    }
+    close(fd);
+    return NULL;
+}
+
+static double measure(unsigned loop_count, unsigned client_count,
+                      unsigned flags)
+{
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    shard_t *shards = fscalloc(loop_count, sizeof *shards);
+    multiloop_handler_t handler = {
+        .obj = shards,
+        .start = (void *) start_shard,
+        .stop = (void *) stop_shard,
+    };
+    multiloop_t *multiloop =
+        make_multiloop((struct sockaddr *) &address, sizeof address,
+                       loop_count, flags, handler);
+    if (!multiloop) {
+        perror("multiloopperf: make_multiloop");
+        exit(EXIT_FAILURE);
+    }
+    client_t *clients = fscalloc(client_count, sizeof *clients);
+    unsigned i;
+    for (i = 0; i < client_count; i++) {
+        client_t *client = &clients[i];
+        client->address = multiloop_get_address(multiloop, &client->addrlen);
+        pthread_create(&client->thread, NULL, run_client, client);
+    }
+    sleep(DURATION_S);
+    uint64_t round_trips = 0;
+    for (i = 0; i < client_count; i++)
+        __atomic_store_n(&clients[i].stop, true, __ATOMIC_RELAXED);
+    for (i = 0; i < client_count; i++) {
+        pthread_join(clients[i].thread, NULL);
+        round_trips += clients[i].round_trips;
+    }
+    fsfree(clients);
+    destroy_multiloop(multiloop);
+    fsfree(shards);
+    return (double) round_trips / DURATION_S;
+}
+
+int main(int argc, const char *const *argv)
+{
+    long max_loops = sysconf(_SC_NPROCESSORS_ONLN);
+    if (argc > 1)
+        max_loops = strtol(argv[1], NULL, 10);
+    if (max_loops < 1) {
+        fprintf(stderr, "Usage: multiloopperf [max-loops]\n");
+        return EXIT_FAILURE;
+    }
+    unsigned flags = 0;
+#ifdef __linux__
+    flags = MULTILOOP_PIN_THREADS;
+#endif
+    unsigned client_count = CLIENTS_PER_LOOP * max_loops;
+    printf("%-6s %-8s %s\n", "loops", "clients", "round-trips/s");
+    unsigned loop_count;
+    for (loop_count = 1;; loop_count *= 2) {
+        if (loop_count > max_loops)
+            loop_count = max_loops;
+        printf("%-6u %-8u %.0f\n", loop_count, client_count,
+               measure(loop_count, client_count, flags));
+        if (loop_count == max_loops)
+            break;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <async/async.h>
+
+/* Compare loop scheduling policies.
+ *
+ * The "busy" workload keeps PIPE_COUNT pipes readable all the time;
+ * each callback consumes a byte and writes one back. Report the number
+ * of I/O callbacks per second.
+ *
+ * The "latency" workload keeps SPINNER_COUNT immediate tasks running,
+ * each of which spins for SPIN_NS and reschedules itself. Meanwhile,
+ * another thread sends a timestamp through a pipe every PING_NS. Report
+ * the throughput of the spinners and the 99th percentile of the time it
+ * takes for a timestamp to reach its callback. */
+
+enum {
+    PIPE_COUNT = 2000,
+    SPINNER_COUNT = 64,
+    SPIN_NS = 5000,
+    PING_NS = 1000000,
+    DURATION_S = 2,
+    MAX_SAMPLES = DURATION_S * 1000000000LL / PING_NS,
+};
+
+typedef struct {
+    async_t *async;
+    uint64_t callbacks;
+} global_t;
+
+typedef struct {
+    global_t *g;
+    int fd[2];
+} pipe_t;
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void die(const char *what)
+{
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static void set_policy(async_t *async, const async_policy_t *policy)
+{
+    if (async_set_policy(async, policy) < 0)
+        die("policyperf: async_set_policy");
+}
+
+static void run(async_t *async)
+{
+    async_timer_start(async, async_now(async) + DURATION_S * ASYNC_S,
+                      (action_1) { async, (act_1) async_quit_loop });
+    while (async_loop(async) < 0)
+        if (errno != EINTR)
+            die("policyperf: async_loop");
+}
+
+static void bounce(pipe_t *p)
+{
+    /* Writing the byte back makes the pipe readable anew. */
+    char c;
+    if (read(p->fd[0], &c, 1) != 1)
+        return;
+    p->g->callbacks++;
+    if (write(p->fd[1], &c, 1) < 0)
+        die("policyperf: write");
+}
+
+static double busy_workload(const async_policy_t *policy)
+{
+    global_t g = { .async = make_async() };
+    set_policy(g.async, policy);
+    pipe_t *pipes = fscalloc(PIPE_COUNT, sizeof *pipes);
+    int i;
+    for (i = 0; i < PIPE_COUNT; i++) {
+        pipe_t *p = &pipes[i];
+        p->g = &g;
+        if (pipe(p->fd) < 0)
+            die("policyperf: pipe");
+        async_register(g.async, p->fd[0], (action_1) { p, (act_1) bounce });
+        if (write(p->fd[1], "x", 1) < 0)
+            die("policyperf: write");
+    }
+    run(g.async);
+    for (i = 0; i < PIPE_COUNT; i++) {
+        async_unregister(g.async, pipes[i].fd[0]);
+        close(pipes[i].fd[0]);
+        close(pipes[i].fd[1]);
+    }
+    fsfree(pipes);
+    destroy_async(g.async);
+    return (double) g.callbacks / DURATION_S;
+}
+
+typedef struct {
+    global_t g;
+    int fd[2];
+    bool stop;
+    uint64_t samples[MAX_SAMPLES];
+    unsigned sample_count;
+} latency_t;
+
+static void spin(latency_t *l)
+{
+    uint64_t t0 = monotonic_ns();
+    while (monotonic_ns() - t0 < SPIN_NS)
+        ;
+    l->g.callbacks++;
+    async_execute(l->g.async, (action_1) { l, (act_1) spin });
+}
+
+static void receive_ping(latency_t *l)
+{
+    uint64_t sent;
+    while (read(l->fd[0], &sent, sizeof sent) == sizeof sent)
+        if (l->sample_count < MAX_SAMPLES)
+            l->samples[l->sample_count++] = monotonic_ns() - sent;
+}
+
+static void *ping(void *arg)
+{
+    latency_t *l = arg;
+    struct timespec period = { .tv_nsec = PING_NS };
+    while (!__atomic_load_n(&l->stop, __ATOMIC_RELAXED)) {
+        nanosleep(&period, NULL);
+        uint64_t now = monotonic_ns();
+        if (write(l->fd[1], &now, sizeof now) < 0)
+            die("policyperf: write");
+    }
+    return NULL;
+}
+
+static int cmp_samples(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static double latency_workload(const async_policy_t *policy, double *p99_us)
+{
+    latency_t *l = fscalloc(1, sizeof *l);
+    l->g.async = make_async();
+    set_policy(l->g.async, policy);
+    if (pipe(l->fd) < 0)
+        die("policyperf: pipe");
+    async_register(l->g.async, l->fd[0],
+                   (action_1) { l, (act_1) receive_ping });
+    int i;
+    for (i = 0; i < SPINNER_COUNT; i++)
+        async_execute(l->g.async, (action_1) { l, (act_1) spin });
+    pthread_t thread;
+    pthread_create(&thread, NULL, ping, l);
+    run(l->g.async);
+    __atomic_store_n(&l->stop, true, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+    async_unregister(l->g.async, l->fd[0]);
+    close(l->fd[0]);
+    close(l->fd[1]);
+    destroy_async(l->g.async);
+    qsort(l->samples, l->sample_count, sizeof l->samples[0], cmp_samples);
+    *p99_us = l->sample_count ?
+        l->samples[l->sample_count * 99 / 100] / 1000.0 : 0;
+    double throughput = (double) l->g.callbacks / DURATION_S;
+    fsfree(l);
+    return throughput;
+}
+
+static void describe(const async_policy_t *policy, char *buf, size_t size)
+{
+    if (policy->adaptive)
+        snprintf(buf, size, "%u-%u/%u", policy->io_burst,
+                 policy->max_io_burst, policy->callback_budget);
+    else
+        snprintf(buf, size, "%u/%u", policy->io_burst,
+                 policy->callback_budget);
+}
+
+int main()
+{
+    static const async_policy_t policies[] = {
+        { .io_burst = 20, .callback_budget = 20 }, /* the default */
+        { .io_burst = 256, .callback_budget = 20 },
+        { .io_burst = 20, .callback_budget = 20, .adaptive = true,
+          .max_io_burst = 4096 },
+        { .io_burst = 20, .callback_budget = 4 },
+        { .io_burst = 20, .callback_budget = 100 },
+    };
+    printf("%-10s %-14s %-12s %-12s %s\n", "workload", "burst/budget",
+           "callbacks/s", "spins/s", "p99 (us)");
+    int i;
+    for (i = 0; i < sizeof policies / sizeof policies[0]; i++) {
+        char name[40];
+        describe(&policies[i], name, sizeof name);
+        printf("%-10s %-14s %-12.0f %-12s %s\n", "busy", name,
+               busy_workload(&policies[i]), "-", "-");
+    }
+    for (i = 0; i < sizeof policies / sizeof policies[0]; i++) {
+        char name[40];
+        describe(&policies[i], name, sizeof name);
+        double p99_us;
+        double spins = latency_workload(&policies[i], &p99_us);
+        printf("%-10s %-14s %-12s %-12.0f %.1f\n", "latency", name, "-",
+               spins, p99_us);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <async/async.h>
+
+enum {
+    ROUNDS = 1000,
+};
+
+typedef struct {
+    async_t *async;
+    uint64_t interval, expires;
+    int round;
+    int64_t lateness[ROUNDS];
+} global_t;
+
+static void tick(global_t *g)
+{
+    g->lateness[g->round++] = async_now(g->async) - g->expires;
+    if (g->round >= ROUNDS) {
+        async_quit_loop(g->async);
+        return;
+    }
+    g->expires = async_now(g->async) + g->interval;
+    async_timer_start(g->async, g->expires, (action_1) { g, (act_1) tick });
+}
+
+static int cmp_lateness(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+/* Run a chain of timers, each started at the given interval from the
+ * expiry of the previous one, and report how late they fire. */
+static void measure(uint64_t interval, bool high_resolution)
+{
+    static global_t g;
+    g.async = make_async();
+    if (high_resolution)
+        async_enable_high_resolution(g.async);
+    g.interval = interval;
+    g.round = 0;
+    g.expires = async_now(g.async) + interval;
+    async_timer_start(g.async, g.expires, (action_1) { &g, (act_1) tick });
+    while (async_loop(g.async) < 0)
+        if (errno != EINTR) {
+            perror("timerlateness");
+            exit(EXIT_FAILURE);
+        }
+    destroy_async(g.async);
+    qsort(g.lateness, ROUNDS, sizeof g.lateness[0], cmp_lateness);
+    int64_t sum = 0;
+    int i;
+    for (i = 0; i < ROUNDS; i++)
+        sum += g.lateness[i];
+    printf("%-10s %-10.0f %-10.1f %-10.1f %-10.1f %.1f\n",
+           high_resolution ? "high" : "default", (double) interval / ASYNC_US,
+           (double) sum / ROUNDS / ASYNC_US,
+           (double) g.lateness[ROUNDS / 2] / ASYNC_US,
+           (double) g.lateness[ROUNDS * 99 / 100] / ASYNC_US,
+           (double) g.lateness[ROUNDS - 1] / ASYNC_US);
+}
+
+int main()
+{
+    static const uint64_t intervals[] = {
+        50 * ASYNC_US, 100 * ASYNC_US, 250 * ASYNC_US, 500 * ASYNC_US, ASYNC_MS,
+    };
+    printf("%-10s %-10s %-10s %-10s %-10s %s\n", "resolution", "interval",
+           "mean", "median", "p99", "max");
+    printf("%-10s %-10s %-10s %-10s %-10s %s\n", "", "(us)", "(us)", "(us)",
+           "(us)", "(us)");
+    int i;
+    for (i = 0; i < sizeof intervals / sizeof intervals[0]; i++) {
+        measure(intervals[i], false);
+        measure(intervals[i], true);
+    }
+    return EXIT_SUCCESS;
+}
@@ -17,8 +17,20 @@ typedef struct {
 
 enum {
     N = 10000000,
+    CHURN_TIMERS = 200000,
+    CHURN_ROUNDS = 20000000,
 };
 
+static fs_realloc_t reallocator;
+static uint64_t allocation_count, callback_count;
+
+static void *counting_realloc(void *ptr, size_t size)
+{
+    if (ptr == NULL)
+        allocation_count++;
+    return (*reallocator)(ptr, size);
+}
+
 static context_t *new_context(global_t *g, bool last)
 {
     context_t *context = fsalloc(sizeof *context);
@@ -30,6 +42,7 @@ static context_t *new_context(global_t *g, bool last)
 static void finish(context_t *context)
 {
     async_t *async = context->g->async;
+    callback_count++;
     async_timer_cancel(async, context->timer);
     if (context->last)
         async_quit_loop(async);
@@ -39,6 +52,7 @@ static void finish(context_t *context)
 static void start(context_t *context)
 {
     async_t *async = context->g->async;
+    callback_count++;
     action_1 dummy_cb = { 0 };
     context->timer =
         async_timer_start(async, async_now(async) + ASYNC_H, dummy_cb);
@@ -55,22 +69,87 @@ static void kick_off(global_t *g)
     async_execute(g->async, start_cb);
 }
 
-int main()
+static async_t *make_perf_async(bool wheel)
 {
     async_t *async = make_async();
+    if (!wheel)
+        async_disable_timing_wheel(async);
+    return async;
+}
+
+/* Every task starts a far-away timer and cancels it in a follow-up
+ * task. Report allocations per executed callback. */
+static double execute_workload(bool wheel, double *allocs)
+{
+    async_t *async = make_perf_async(wheel);
     global_t g = {
         .async = async,
     };
     uint64_t t0 = async_now(async);
+    allocation_count = callback_count = 0;
     kick_off(&g);
     while (async_loop(async) < 0)
         if (errno != EINTR) {
-            perror("fsadns_test");
-            return EXIT_FAILURE;
+            perror("timerperf");
+            exit(EXIT_FAILURE);
         }
     async_flush(async, async_now(async) + ASYNC_MIN);
     uint64_t t1 = async_now(async);
+    *allocs = (double) allocation_count / callback_count;
+    destroy_async(async);
+    return (double) (t1 - t0) / ASYNC_S;
+}
+
+/* A large population of idle timeouts (between 1 s and 2 min) is
+ * maintained; each round cancels a random timer and restarts it. None
+ * of the timers expires. Report allocations per round. */
+static double churn_workload(bool wheel, double *allocs)
+{
+    async_t *async = make_perf_async(wheel);
+    async_timer_t **timers = fscalloc(CHURN_TIMERS, sizeof *timers);
+    action_1 dummy_cb = { 0 };
+    unsigned seed = 1;
+    uint64_t t0 = async_now(async);
+    for (int i = 0; i < CHURN_TIMERS; i++) {
+        uint64_t delay = ASYNC_S + rand_r(&seed) % (119 * ASYNC_S);
+        timers[i] = async_timer_start(async, t0 + delay, dummy_cb);
+    }
+    allocation_count = 0;
+    for (int i = 0; i < CHURN_ROUNDS; i++) {
+        int n = rand_r(&seed) % CHURN_TIMERS;
+        uint64_t delay = ASYNC_S + rand_r(&seed) % (119 * ASYNC_S);
+        async_timer_cancel(async, timers[n]);
+        timers[n] = async_timer_start(async, t0 + delay, dummy_cb);
+    }
+    uint64_t t1 = async_now(async);
+    *allocs = (double) allocation_count / CHURN_ROUNDS;
+    for (int i = 0; i < CHURN_TIMERS; i++)
+        async_timer_cancel(async, timers[i]);
+    fsfree(timers);
     destroy_async(async);
-    printf("%g\n", (double) (t1 - t0) / ASYNC_S);
+    return (double) (t1 - t0) / ASYNC_S;
+}
+
+static void report(const char *store, const char *workload, double seconds,
+                   double allocs)
+{
+    printf("%-8s %-10s %-10g %g\n", store, workload, seconds, allocs);
+}
+
+int main()
+{
+    reallocator = fs_get_reallocator();
+    fs_set_reallocator(counting_realloc);
+    double allocs;
+    printf("%-8s %-10s %-10s %s\n", "store", "workload", "seconds",
+           "allocs/op");
+    double seconds = execute_workload(true, &allocs);
+    report("wheel", "execute", seconds, allocs);
+    seconds = execute_workload(false, &allocs);
+    report("priorq", "execute", seconds, allocs);
+    seconds = churn_workload(true, &allocs);
+    report("wheel", "churn", seconds, allocs);
+    seconds = churn_workload(false, &allocs);
+    report("priorq", "churn", seconds, allocs);
     return EXIT_SUCCESS;
 }
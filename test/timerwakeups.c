@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <async/async.h>
+
+/* Model a population of idle connections, each of which keeps
+ * rearming a timeout of a random length. Report how many times per
+ * second the loop waits for I/O (that is, wakes up) and how late the
+ * timeouts fire on average with different amounts of slack.
+ *
+ * The callback budget is lifted so that all timers due at a wakeup
+ * are fired before the loop polls again. */
+
+enum {
+    TIMER_COUNT = 10000,
+    MIN_TIMEOUT_MS = 50,
+    MAX_TIMEOUT_MS = 150,
+    DURATION_S = 2,
+};
+
+typedef struct global global_t;
+
+typedef struct {
+    global_t *g;
+    async_timer_t timer;
+    uint64_t expires;
+} conn_t;
+
+struct global {
+    async_t *async;
+    uint64_t slack;
+    uint64_t fired, total_lateness;
+    conn_t conns[TIMER_COUNT];
+};
+
+static void rearm(conn_t *conn)
+{
+    global_t *g = conn->g;
+    uint64_t timeout =
+        (MIN_TIMEOUT_MS + random() % (MAX_TIMEOUT_MS - MIN_TIMEOUT_MS)) *
+            ASYNC_MS +
+        random() % ASYNC_MS;
+    conn->expires = async_now(g->async) + timeout;
+    async_timer_rearm_slack(g->async, &conn->timer, conn->expires, g->slack);
+}
+
+static void time_out(conn_t *conn)
+{
+    global_t *g = conn->g;
+    g->fired++;
+    g->total_lateness += async_now(g->async) - conn->expires;
+    rearm(conn);
+}
+
+static void measure(uint64_t slack, bool high_resolution)
+{
+    static global_t g;
+    g.async = make_async();
+    if (high_resolution)
+        async_enable_high_resolution(g.async);
+    async_policy_t policy;
+    async_get_policy(g.async, &policy);
+    policy.callback_budget = TIMER_COUNT + 1;
+    async_set_policy(g.async, &policy);
+    g.slack = slack;
+    g.fired = g.total_lateness = 0;
+    srandom(1);
+    int i;
+    for (i = 0; i < TIMER_COUNT; i++) {
+        conn_t *conn = &g.conns[i];
+        conn->g = &g;
+        async_timer_init(&conn->timer, (action_1) { conn, (act_1) time_out });
+        rearm(conn);
+    }
+    async_timer_start(g.async, async_now(g.async) + DURATION_S * ASYNC_S,
+                      (action_1) { g.async, (act_1) async_quit_loop });
+    while (async_loop(g.async) < 0)
+        if (errno != EINTR) {
+            perror("timerwakeups");
+            exit(EXIT_FAILURE);
+        }
+    async_stats_t stats;
+    async_get_stats(g.async, &stats);
+    for (i = 0; i < TIMER_COUNT; i++)
+        async_timer_stop(g.async, &g.conns[i].timer);
+    destroy_async(g.async);
+    printf("%-10s %-10.1f %-12.0f %-12.0f %.1f\n",
+           high_resolution ? "high" : "default", (double) slack / ASYNC_MS,
+           (double) stats.io_waits / DURATION_S,
+           (double) g.fired / DURATION_S,
+           g.fired ? (double) g.total_lateness / g.fired / ASYNC_US : 0);
+}
+
+int main()
+{
+    static const uint64_t slacks[] = {
+        0, ASYNC_MS, 10 * ASYNC_MS, 50 * ASYNC_MS,
+    };
+    printf("%-10s %-10s %-12s %-12s %s\n", "resolution", "slack",
+           "wakeups/s", "timeouts/s", "mean lateness");
+    printf("%-10s %-10s %-12s %-12s %s\n", "", "(ms)", "", "", "(us)");
+    int i;
+    for (i = 0; i < sizeof slacks / sizeof slacks[0]; i++) {
+        measure(slacks[i], false);
+        measure(slacks[i], true);
+    }
+    return EXIT_SUCCESS;
+}